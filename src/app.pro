@@ -0,0 +1,48 @@
+TEMPLATE	      = app
+CONFIG		     += qt warn_on force_debug_info thread c++17
+FORMS		      = mainwindow.ui prefsdialog.ui renamedialog.ui
+
+HEADERS		      = include/dirscan.h \
+                        include/export.h \
+                        include/imgcache.h \
+                        include/imgentry.h \
+                        include/mainwindow.h \
+                        include/prefsdlg.h \
+                        include/renamedlg.h \
+                        include/trace.h \
+                        include/util-widgets.h
+
+SOURCES		      = main.cc util-widgets.cc \
+                        prefsdlg.cc renamedlg.cc renderer.cc tables.cc \
+                        dirscan.cc imgcache.cc export.cc trace.cc
+
+isEmpty(PREFIX) {
+PREFIX = /usr/local
+}
+
+TARGET                = equiv
+DATADIR               = $$PREFIX/share/equiv
+DOCDIR                = $$PREFIX/share/doc/equiv
+
+*-g++ {
+QMAKE_CXXFLAGS += -fno-diagnostics-show-caret
+}
+
+unix:INCLUDEPATH      += include
+win32:INCLUDEPATH     += include
+
+!win32:DEFINES       += "DATADIR=\\\"$$DATADIR\\\""
+!win32:DEFINES       += "DOCDIR=\\\"$$DOCDIR\\\""
+release:DEFINES      += NO_CHECK
+win32:DEFINES        += QT_DLL QT_THREAD_SUPPORT HAVE_CONFIG_H _USE_MATH_DEFINES
+
+target.path           = $$PREFIX/bin
+INSTALLS += target
+
+QT += widgets gui sql
+
+LIBS                 += -L$$OUT_PWD/core -lequivcore
+PRE_TARGETDEPS       += $$OUT_PWD/core/libequivcore.a
+
+RESOURCES += \
+    equiv.qrc
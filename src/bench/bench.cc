@@ -0,0 +1,651 @@
+/*
+ *   bench.cc - run the image pipeline of equiv without a GUI and time it
+ */
+#include <cstdio>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <utility>
+
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QBuffer>
+#include <QFile>
+#include <QFileInfo>
+#include <QDirIterator>
+#include <QImage>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QPixmap>
+#include <QColorSpace>
+#include <QCryptographicHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QThreadPool>
+#include <QTransform>
+
+#include "tweaks.h"
+#include "geometry.h"
+#include "resample.h"
+#include "pipeline.h"
+#include "colorxform.h"
+#include "colors.h"
+
+namespace {
+
+/* An encoded image, either generated or read from a file.  */
+struct bench_source
+{
+	QString name;
+	QByteArray data;
+	QByteArray format;
+};
+
+struct bench_cspace
+{
+	const char *name;
+	int idx;
+};
+
+/* The colour spaces are applied as overrides, the way the colour space box in
+   the viewer does it, so that they do not depend on what the encoders write.  */
+const bench_cspace all_cspaces[] = {
+	{ "file", 0 },
+	{ "AdobeRGB", QColorSpace::AdobeRgb },
+	{ "DisplayP3", QColorSpace::DisplayP3 },
+	{ "ProPhotoRGB", QColorSpace::ProPhotoRgb }
+};
+
+struct bench_tweaks
+{
+	const char *name;
+	img_tweaks tw;
+};
+
+std::vector<bench_tweaks> all_tweaks ()
+{
+	std::vector<bench_tweaks> v;
+	img_tweaks none;
+	v.push_back ({ "none", none });
+
+	img_tweaks white;
+	white.white = QColor (255, 235, 210);
+	v.push_back ({ "white", white });
+
+	img_tweaks full = white;
+	full.blacklevel = 10;
+	full.brightness = 10;
+	full.sat = 20;
+	full.gamma = 10;
+	v.push_back ({ "full", full });
+
+	img_tweaks rotate;
+	rotate.rot = 90;
+	rotate.mirrored = true;
+	v.push_back ({ "rotate", rotate });
+	return v;
+}
+
+struct timing
+{
+	double median_ms;
+	double min_ms;
+};
+
+/* Run F REPEAT times, and return the median and the fastest run.  */
+template<class F>
+timing time_stage (int repeat, F f)
+{
+	std::vector<double> t;
+	for (int i = 0; i < repeat; i++) {
+		QElapsedTimer timer;
+		timer.start ();
+		f ();
+		t.push_back (timer.nsecsElapsed () / 1e6);
+	}
+	std::sort (t.begin (), t.end ());
+	return { t[t.size () / 2], t[0] };
+}
+
+/* A reproducible test image: gradients in each channel with some noise, so
+   that the encoders cannot compress it away.  */
+QImage synthetic_image (QSize sz, bool deep)
+{
+	QImage img (sz, deep ? QImage::Format_RGBA64 : QImage::Format_RGB32);
+	int w = sz.width ();
+	int h = sz.height ();
+	uint32_t seed = 0x9e3779b9;
+	for (int y = 0; y < h; y++) {
+		uchar *line = img.scanLine (y);
+		for (int x = 0; x < w; x++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			int noise = seed & 4095;
+			int r = std::min (65535, (int)((int64_t)x * 61440 / w) + noise);
+			int g = std::min (65535, (int)((int64_t)y * 61440 / h) + noise);
+			int b = std::min (65535, (int)((int64_t)(x + y) * 30720 / (w + h)) + 30720 - noise);
+			if (deep) {
+				uint16_t *p = (uint16_t *)line + 4 * x;
+				p[0] = r;
+				p[1] = g;
+				p[2] = b;
+				p[3] = 65535;
+			} else
+				((QRgb *)line)[x] = qRgb (r >> 8, g >> 8, b >> 8);
+		}
+	}
+	img.setColorSpace (QColorSpace::SRgb);
+	return img;
+}
+
+/* 8 bit images are encoded as JPEG, like most camera files, 16 bit images
+   as PNG.  */
+bench_source synthetic_source (double mp, bool deep)
+{
+	int w = std::max (1, (int)lround (sqrt (mp * 1e6 * 3 / 2)));
+	int h = std::max (1, w * 2 / 3);
+	QImage img = synthetic_image (QSize (w, h), deep);
+
+	bench_source src;
+	src.name = "synthetic";
+	src.format = deep ? "png" : "jpeg";
+	QBuffer buf (&src.data);
+	buf.open (QIODevice::WriteOnly);
+	QImageWriter writer (&buf, src.format);
+	/* For PNG, this selects a low compression level, which keeps generating
+	   the large sizes bearable.  */
+	writer.setQuality (90);
+	writer.write (img);
+	return src;
+}
+
+QJsonObject stage_json (const timing &t, double mp)
+{
+	QJsonObject o;
+	o["ms"] = t.median_ms;
+	o["min_ms"] = t.min_ms;
+	o["mpps"] = t.median_ms > 0 ? mp / (t.median_ms / 1000) : 0;
+	return o;
+}
+
+struct bench_config
+{
+	int repeat = 3;
+	QSize view { 1920, 1080 };
+	std::vector<bench_cspace> cspaces;
+	std::vector<bench_tweaks> tweaks;
+};
+
+/* Run the pipeline of the renderer on SRC in every configuration, and append
+   one result per colour space and tweak combination to RESULTS.  */
+void run_source (const bench_source &src, const bench_config &cfg, QJsonArray &results)
+{
+	QImage decoded;
+	timing t_decode = time_stage (cfg.repeat, [&] () {
+		QBuffer buf;
+		buf.setData (src.data);
+		buf.open (QIODevice::ReadOnly);
+		QImageReader reader (&buf, src.format);
+		decoded = reader.read ();
+	});
+	if (decoded.isNull ()) {
+		fprintf (stderr, "%s: could not decode\n", src.name.toLocal8Bit ().constData ());
+		return;
+	}
+	timing t_hash = time_stage (cfg.repeat, [&] () {
+		QCryptographicHash::hash (src.data, QCryptographicHash::Md5);
+	});
+
+	QSize sz = decoded.size ();
+	double mp = (double)sz.width () * sz.height () / 1e6;
+	int depth = decoded.depth () == 64 ? 16 : 8;
+
+	for (auto &cs: cfg.cspaces) {
+		linear_buffer linear;
+		timing t_linear = time_stage (cfg.repeat, [&] () {
+			linear = linear_image (decoded, cs.idx);
+		});
+		linear_stats st;
+		timing t_stats = time_stage (cfg.repeat, [&] () {
+			st = measure_linear (linear);
+		});
+
+		for (auto &bt: cfg.tweaks) {
+			const img_tweaks &tw = bt.tw;
+			fprintf (stderr, "%s %dx%d %d bit %s %s\n", src.name.toLocal8Bit ().constData (),
+				 sz.width (), sz.height (), depth, cs.name, bt.name);
+
+			QImage tweaked, encoded, corrected_src, rotated, scaled;
+			QPixmap pm;
+			timing t_tweak = time_stage (cfg.repeat, [&] () {
+				tweaked = tweak_linear (linear, tw, st);
+			});
+			timing t_srgb = time_stage (cfg.repeat, [&] () {
+				encoded = tweaked;
+				convert_color_space (encoded, QColorSpace::SRgb);
+			});
+			timing t_convert = time_stage (cfg.repeat, [&] () {
+				corrected_src = encoded.convertToFormat (QImage::Format_ARGB32);
+			});
+			timing t_rotate = time_stage (cfg.repeat, [&] () {
+				rotated = rotate_image (corrected_src, tw.rot, tw.mirrored);
+			});
+			/* Scale to fit the view, as the renderer does: the source is
+			   resampled before it is rotated.  */
+			QSize shown = rotated_size (sz, tw.rot);
+			shown.scale (cfg.view, Qt::KeepAspectRatio);
+			QSize src_sz = rotated_size (shown, tw.rot);
+			timing t_scale = time_stage (cfg.repeat, [&] () {
+				scaled = resample_image (corrected_src, src_sz);
+			});
+			timing t_pixmap = time_stage (cfg.repeat, [&] () {
+				pm = QPixmap::fromImage (rotated);
+			});
+
+			QJsonObject stages;
+			stages["decode"] = stage_json (t_decode, mp);
+			stages["hash"] = stage_json (t_hash, mp);
+			stages["linearize"] = stage_json (t_linear, mp);
+			stages["stats"] = stage_json (t_stats, mp);
+			stages["tweak"] = stage_json (t_tweak, mp);
+			stages["srgb"] = stage_json (t_srgb, mp);
+			stages["convert"] = stage_json (t_convert, mp);
+			stages["rotate"] = stage_json (t_rotate, mp);
+			stages["scale"] = stage_json (t_scale, mp);
+			stages["pixmap"] = stage_json (t_pixmap, mp);
+			double total = 0;
+			for (auto &t: { t_decode, t_hash, t_linear, t_stats, t_tweak, t_srgb,
+					t_convert, t_rotate, t_scale, t_pixmap })
+				total += t.median_ms;
+
+			QJsonObject r;
+			r["source"] = src.name;
+			r["format"] = QString (src.format);
+			r["width"] = sz.width ();
+			r["height"] = sz.height ();
+			r["megapixels"] = mp;
+			r["depth"] = depth;
+			r["colorspace"] = cs.name;
+			r["tweaks"] = bt.name;
+			r["stages"] = stages;
+			r["total_ms"] = total;
+			results.append (r);
+		}
+	}
+}
+
+bool read_source (const QString &path, bench_source &src)
+{
+	QFile f (path);
+	if (!f.open (QIODevice::ReadOnly))
+		return false;
+	src.name = path;
+	src.data = f.readAll ();
+	QBuffer buf (&src.data);
+	buf.open (QIODevice::ReadOnly);
+	src.format = QImageReader::imageFormat (&buf);
+	return !src.format.isEmpty ();
+}
+
+template<class T, class L>
+std::vector<T> pick_named (const L &all, const QString &names)
+{
+	std::vector<T> v;
+	for (auto &n: names.split (',', Qt::SkipEmptyParts))
+		for (auto &x: all)
+			if (n == x.name)
+				v.push_back (x);
+	return v;
+}
+
+/* Differences between pairs of images, per channel, in 16 bit units.  */
+struct image_diff
+{
+	const char *name;
+	int max[3] = { 0, 0, 0 };
+	double sum[3] = { 0, 0, 0 };
+	qint64 pixels = 0;
+	int size_mismatches = 0;
+
+	image_diff (const char *n) : name (n)
+	{
+	}
+	void add (const QImage &a, const QImage &b);
+	int worst () const
+	{
+		return size_mismatches > 0 ? 65535 : std::max ({ max[0], max[1], max[2] });
+	}
+	void print () const;
+};
+
+void image_diff::add (const QImage &a_in, const QImage &b_in)
+{
+	if (a_in.size () != b_in.size ()) {
+		size_mismatches++;
+		return;
+	}
+	QImage a = a_in.convertToFormat (QImage::Format_RGBA64);
+	QImage b = b_in.convertToFormat (QImage::Format_RGBA64);
+	for (int y = 0; y < a.height (); y++) {
+		const uint16_t *pa = (const uint16_t *)a.constScanLine (y);
+		const uint16_t *pb = (const uint16_t *)b.constScanLine (y);
+		for (int x = 0; x < a.width (); x++)
+			for (int c = 0; c < 3; c++) {
+				int d = std::abs (pa[4 * x + c] - pb[4 * x + c]);
+				max[c] = std::max (max[c], d);
+				sum[c] += d;
+			}
+	}
+	pixels += (qint64)a.width () * a.height ();
+}
+
+void image_diff::print () const
+{
+	double n = std::max<qint64> (1, pixels);
+	printf ("%-10s %10lld pixels  max error %5d %5d %5d  mean %.4f %.4f %.4f%s\n", name, pixels,
+		max[0], max[1], max[2], sum[0] / n, sum[1] / n, sum[2] / n,
+		size_mismatches > 0 ? "  SIZE MISMATCH" : "");
+}
+
+/* A random image of random size.  Each channel gets its own range, often
+   reaching 0 or 65535, with plenty of pixels at its ends, where clamping
+   matters.  Since the channels' extremes differ, a statistics loop that mixes
+   up channels is caught.  */
+QImage random_image (std::mt19937 &rng, bool deep)
+{
+	std::uniform_int_distribution<int> dim (1, 300);
+	std::uniform_int_distribution<int> val (0, 65535);
+	std::uniform_int_distribution<int> kind (0, 9);
+	int lo[3], hi[3];
+	for (int c = 0; c < 3; c++) {
+		lo[c] = kind (rng) < 3 ? 0 : val (rng);
+		hi[c] = kind (rng) < 3 ? 65535 : val (rng);
+		if (lo[c] > hi[c])
+			std::swap (lo[c], hi[c]);
+	}
+	QImage img (QSize (dim (rng), dim (rng)), deep ? QImage::Format_RGBA64 : QImage::Format_RGB32);
+	for (int y = 0; y < img.height (); y++) {
+		uchar *line = img.scanLine (y);
+		for (int x = 0; x < img.width (); x++) {
+			int v[3];
+			for (int c = 0; c < 3; c++) {
+				int k = kind (rng);
+				v[c] = k == 0 ? lo[c] : k == 1 ? hi[c] : std::uniform_int_distribution<int> (lo[c], hi[c]) (rng);
+			}
+			if (deep) {
+				uint16_t *p = (uint16_t *)line + 4 * x;
+				p[0] = v[0];
+				p[1] = v[1];
+				p[2] = v[2];
+				p[3] = 65535;
+			} else
+				((QRgb *)line)[x] = qRgb (v[0] >> 8, v[1] >> 8, v[2] >> 8);
+		}
+	}
+	img.setColorSpace (QColorSpace::SRgb);
+	return img;
+}
+
+/* Check both statistics loops on a linear image whose channels have known,
+   different extremes.  Returns the number of loops that get them wrong.  */
+int check_channel_stats ()
+{
+	const int lo[3] = { 1000, 2000, 3000 };
+	const int hi[3] = { 60000, 40000, 20000 };
+	QImage linear (QSize (7, 5), QImage::Format_RGBA64);
+	for (int y = 0; y < linear.height (); y++) {
+		uint16_t *p = (uint16_t *)linear.scanLine (y);
+		for (int x = 0; x < linear.width (); x++, p += 4) {
+			for (int c = 0; c < 3; c++)
+				p[c] = (lo[c] + hi[c]) / 2;
+			p[3] = 65535;
+		}
+	}
+	/* Put each extreme in a different pixel.  */
+	for (int c = 0; c < 3; c++) {
+		((uint16_t *)linear.scanLine (c))[4 * c + c] = lo[c];
+		((uint16_t *)linear.scanLine (4 - c))[4 * (6 - c) + c] = hi[c];
+	}
+	int bad = 0;
+	for (auto st: { measure_linear (linear_buffer::from_image (linear, false)), reference_measure_linear (linear) })
+		if (st.minr != lo[0] || st.ming != lo[1] || st.minb != lo[2]
+		    || st.maxr != hi[0] || st.maxg != hi[1] || st.maxb != hi[2])
+			bad++;
+	return bad;
+}
+
+/* 8 bit sRGB images are linearized through srgb_table, which is exact,
+   while Qt interpolates its transfer function.  Check every entry against
+   the sRGB curve, and store in QT_WORST how far Qt's linearization of the
+   same 256 values is from it.  Since the fast path works per channel, that
+   bounds its difference from the reference on any image.  Returns the
+   number of entries off the curve.  */
+int check_srgb8_table (int &qt_worst)
+{
+	QImage ramp (QSize (256, 1), QImage::Format_RGB32);
+	for (int v = 0; v < 256; v++)
+		((QRgb *)ramp.scanLine (0))[v] = qRgb (v, v, v);
+	ramp.setColorSpace (QColorSpace::SRgb);
+	image_diff d ("table");
+	d.add (linear_image (ramp, 0).to_image (), reference_linear_image (ramp, 0));
+	qt_worst = d.worst ();
+
+	int bad = 0;
+	for (int v = 0; v < 256; v++) {
+		double s = v / 255.;
+		double l = s < 0.04045 ? s / 12.92 : pow ((s + 0.055) / 1.055, 2.4);
+		if (srgb_table.to_linear16[v] != lrint (l * 65535))
+			bad++;
+	}
+	return bad;
+}
+
+/* Every combination of a few values of each colour tweak.  */
+std::vector<img_tweaks> tweak_grid ()
+{
+	std::vector<img_tweaks> v;
+	for (QColor white: { QColor (Qt::white), QColor (255, 235, 210), QColor (190, 220, 255) })
+		for (int black: { 0, 20 })
+			for (int bright: { -25, 0, 25 })
+				for (int sat: { -40, 0, 40 })
+					for (int gamma: { -30, 0, 30 }) {
+						img_tweaks tw;
+						tw.white = white;
+						tw.blacklevel = black;
+						tw.brightness = bright;
+						tw.sat = sat;
+						tw.gamma = gamma;
+						v.push_back (tw);
+					}
+	return v;
+}
+
+bool same_stats (const linear_stats &a, const linear_stats &b)
+{
+	return (a.maxr == b.maxr && a.maxg == b.maxg && a.maxb == b.maxb
+		&& a.minr == b.minr && a.ming == b.ming && a.minb == b.minb && a.minavg == b.minavg);
+}
+
+/* Compare the pipeline against the reference versions in reference.cc on
+   random images, for all colour spaces and combinations of tweaks.  Returns
+   the exit status: nonzero if any difference exceeds TOLERANCE, or
+   LINEAR_TOLERANCE for the linearization of 8 bit sRGB images.  */
+int run_verify (int cases, unsigned seed, int tolerance, int linear_tolerance)
+{
+	std::mt19937 rng (seed);
+	std::vector<img_tweaks> combos = tweak_grid ();
+	image_diff d_linear ("linearize");
+	image_diff d_linear8 ("linearize8");
+	image_diff d_tweak ("tweak");
+	image_diff d_apply ("apply");
+	image_diff d_geom ("geometry");
+	image_diff d_xform ("transform");
+	int stats_total = 0, stats_bad = 0;
+
+	for (int i = 0; i < cases; i++) {
+		QImage src = random_image (rng, i % 2 == 1);
+		fprintf (stderr, "case %d: %dx%d, %d bit\n", i, src.width (), src.height (), i % 2 == 1 ? 16 : 8);
+		for (auto &cs: all_cspaces) {
+			/* The later stages start from the reference linearization,
+			   so that its differences do not carry over.  */
+			QImage linear = reference_linear_image (src, cs.idx);
+			bool fast = i % 2 == 0 && cs.idx == 0;
+			(fast ? d_linear8 : d_linear).add (linear_image (src, cs.idx).to_image (), linear);
+			linear_buffer planes = linear_buffer::from_image (linear, src.hasAlphaChannel ());
+			linear_stats ref_st = reference_measure_linear (linear);
+			stats_total++;
+			if (!same_stats (measure_linear (planes), ref_st))
+				stats_bad++;
+			for (auto &tw: combos) {
+				QImage ref = reference_tweak_linear (linear, tw, ref_st);
+				d_tweak.add (tweak_linear (planes, tw, ref_st), ref);
+				ref.convertToColorSpace (QColorSpace::SRgb);
+				d_apply.add (apply_tweaks (planes, tw, ref_st), ref);
+			}
+		}
+		/* The cached transforms against Qt's, on coloured pixels, both to
+		   linear light and back to sRGB.  */
+		for (auto &cs: all_cspaces) {
+			QColorSpace from = cs.idx != 0 ? QColorSpace ((QColorSpace::NamedColorSpace)cs.idx) : QColorSpace (QColorSpace::SRgb);
+			QColorSpace linear_cs = from;
+			linear_cs.setTransferFunction (QColorSpace::TransferFunction::Linear);
+			for (auto [a, b]: { std::pair (from, linear_cs), std::pair (linear_cs, QColorSpace (QColorSpace::SRgb)) }) {
+				QImage in = src.convertToFormat (QImage::Format_RGBA64);
+				in.setColorSpace (a);
+				QImage ref = in;
+				ref.applyColorTransform (a.transformationToColorSpace (b));
+				QImage ours = in;
+				convert_color_space (ours, b);
+				d_xform.add (ours, ref);
+			}
+		}
+		for (int rot: { 0, 90, 180, 270 })
+			for (bool mirror: { false, true }) {
+				QTransform t;
+				t.rotate (rot);
+				if (mirror)
+					t.scale (-1, 1);
+				d_geom.add (rotate_image (src, rot, mirror), src.transformed (t));
+			}
+	}
+
+	int channels_bad = check_channel_stats ();
+	int table_qt_worst;
+	int table_bad = check_srgb8_table (table_qt_worst);
+
+	printf ("%d cases, %d tweak combinations, seed %u\n", cases, (int)combos.size (), seed);
+	printf ("stats      %d of %d differ\n", stats_bad, stats_total);
+	printf ("channels   %d of 2 statistics loops wrong\n", channels_bad);
+	printf ("srgb8      %d of 256 table entries off the sRGB curve, Qt up to %d away\n", table_bad, table_qt_worst);
+	for (auto d: { &d_linear, &d_linear8, &d_tweak, &d_apply, &d_geom, &d_xform })
+		d->print ();
+	bool ok = (stats_bad == 0 && channels_bad == 0 && table_bad == 0
+		   && d_linear.worst () == 0 && d_linear8.worst () <= linear_tolerance && d_tweak.worst () <= tolerance && d_apply.worst () <= tolerance
+		   && d_geom.worst () == 0 && d_xform.worst () == 0);
+	printf ("%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+}
+
+int main (int argc, char **argv)
+{
+	/* We need a QGuiApplication for QPixmap, but no display.  */
+	if (qEnvironmentVariableIsEmpty ("QT_QPA_PLATFORM"))
+		qputenv ("QT_QPA_PLATFORM", "offscreen");
+	QGuiApplication app (argc, argv);
+	QCoreApplication::setApplicationName ("equiv-bench");
+
+	QCommandLineParser cmdp;
+	cmdp.setApplicationDescription ("Time the stages of the equiv image pipeline and print the results as JSON.");
+	cmdp.addHelpOption ();
+	QCommandLineOption sizes_option ("sizes", "Sizes of the synthetic images in megapixels, comma separated.",
+					 "list", "1,4,16,50,100");
+	QCommandLineOption depths_option ("depths", "Bit depths of the synthetic images: 8 (JPEG) and/or 16 (PNG).",
+					  "list", "8,16");
+	QCommandLineOption cspaces_option ("colorspaces", "Colour spaces: file, AdobeRGB, DisplayP3, ProPhotoRGB.",
+					   "list", "file,AdobeRGB,DisplayP3");
+	QCommandLineOption tweaks_option ("tweaks", "Tweak combinations: none, white, full, rotate.",
+					  "list", "none,white,full,rotate");
+	QCommandLineOption repeat_option ("repeat", "Number of runs of each stage; the median is reported.", "n", "3");
+	QCommandLineOption view_option ("view", "Size of the view images are scaled to.", "WxH", "1920x1080");
+	QCommandLineOption label_option ("label", "A label to store with the results, such as a commit id.", "text");
+	QCommandLineOption output_option ({ "o", "output" }, "Write the results to <file> instead of stdout.", "file");
+	QCommandLineOption nosynth_option ("no-synthetic", "Only benchmark the images given on the command line.");
+	QCommandLineOption reference_option ("reference", "Time the reference versions of the pixel loops.");
+	QCommandLineOption verify_option ("verify", "Instead of timing, compare the pipeline against the reference versions on random images.");
+	QCommandLineOption cases_option ("cases", "Number of random images for --verify.", "n", "8");
+	QCommandLineOption seed_option ("seed", "Random seed for --verify.", "n", "1");
+	QCommandLineOption tolerance_option ("tolerance", "Largest difference --verify accepts, in 16 bit units.", "n", "0");
+	QCommandLineOption linear_tolerance_option ("linear-tolerance", "Largest difference --verify accepts for linearizing 8 bit sRGB images, which is exact while Qt interpolates.  The srgb8 line of --verify gives the bound.", "n", "0");
+	cmdp.addOptions ({ sizes_option, depths_option, cspaces_option, tweaks_option, repeat_option,
+			   view_option, label_option, output_option, nosynth_option, reference_option,
+			   verify_option, cases_option, seed_option, tolerance_option,
+			   linear_tolerance_option });
+	cmdp.addPositionalArgument ("images", "Image files or directories to use as a corpus of real images.", "[images...]");
+	cmdp.process (app);
+
+	if (cmdp.isSet (verify_option))
+		return run_verify (cmdp.value (cases_option).toInt (), cmdp.value (seed_option).toUInt (),
+				   cmdp.value (tolerance_option).toInt (), cmdp.value (linear_tolerance_option).toInt ());
+	if (cmdp.isSet (reference_option) || !qEnvironmentVariableIsEmpty ("EQUIV_REFERENCE"))
+		use_reference_pipeline = true;
+
+	bench_config cfg;
+	cfg.repeat = std::max (1, cmdp.value (repeat_option).toInt ());
+	QStringList view = cmdp.value (view_option).split ('x');
+	if (view.size () == 2)
+		cfg.view = QSize (view[0].toInt (), view[1].toInt ());
+	cfg.cspaces = pick_named<bench_cspace> (all_cspaces, cmdp.value (cspaces_option));
+	cfg.tweaks = pick_named<bench_tweaks> (all_tweaks (), cmdp.value (tweaks_option));
+
+	QJsonArray results;
+	if (!cmdp.isSet (nosynth_option)) {
+		for (auto &s: cmdp.value (sizes_option).split (',', Qt::SkipEmptyParts))
+			for (auto &d: cmdp.value (depths_option).split (',', Qt::SkipEmptyParts))
+				run_source (synthetic_source (s.toDouble (), d == "16"), cfg, results);
+	}
+	for (auto &arg: cmdp.positionalArguments ()) {
+		QStringList files;
+		if (QFileInfo (arg).isDir ()) {
+			QDirIterator it (arg, QDir::Files, QDirIterator::Subdirectories);
+			while (it.hasNext ())
+				files << it.next ();
+			files.sort ();
+		} else
+			files << arg;
+		for (auto &f: files) {
+			bench_source src;
+			if (read_source (f, src))
+				run_source (src, cfg, results);
+		}
+	}
+
+	QJsonObject doc;
+	doc["benchmark"] = "equiv-bench";
+	doc["version"] = 1;
+	doc["label"] = cmdp.value (label_option);
+	doc["qt"] = qVersion ();
+	doc["threads"] = QThreadPool::globalInstance ()->maxThreadCount ();
+	doc["repeat"] = cfg.repeat;
+	doc["reference"] = use_reference_pipeline;
+	doc["view"] = QString ("%1x%2").arg (cfg.view.width ()).arg (cfg.view.height ());
+	doc["results"] = results;
+	QByteArray json = QJsonDocument (doc).toJson (QJsonDocument::Indented);
+
+	if (cmdp.isSet (output_option)) {
+		QFile f (cmdp.value (output_option));
+		if (!f.open (QIODevice::WriteOnly) || f.write (json) != json.size ()) {
+			fprintf (stderr, "error: cannot write %s\n", cmdp.value (output_option).toLocal8Bit ().constData ());
+			return 1;
+		}
+	} else
+		fwrite (json.constData (), 1, json.size (), stdout);
+	return 0;
+}
@@ -0,0 +1,21 @@
+TEMPLATE	      = app
+CONFIG		     += qt console warn_on force_debug_info thread c++17
+CONFIG		     -= app_bundle
+
+SOURCES		      = bench.cc
+
+TARGET                = equiv-bench
+
+*-g++ {
+QMAKE_CXXFLAGS += -fno-diagnostics-show-caret
+}
+
+INCLUDEPATH          += ../include
+
+release:DEFINES      += NO_CHECK
+win32:DEFINES        += QT_DLL QT_THREAD_SUPPORT HAVE_CONFIG_H _USE_MATH_DEFINES
+
+QT += gui
+
+LIBS                 += -L$$OUT_PWD/../core -lequivcore
+PRE_TARGETDEPS       += $$OUT_PWD/../core/libequivcore.a
@@ -0,0 +1,174 @@
+#include <cstdlib>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <QtGlobal>
+#include <QMutex>
+
+#ifdef Q_OS_WIN
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "bufpool.h"
+
+namespace {
+
+constexpr size_t huge_page = 2 * 1024 * 1024;
+/* Smaller buffers are not worth keeping, and malloc handles them well.  */
+constexpr size_t pool_min = 1024 * 1024;
+
+QMutex pool_mutex;
+/* Unused buffers by size class, most recently freed at the back.  */
+std::map<size_t, std::vector<void *>> free_lists;
+size_t free_limit = 512 * 1024 * 1024;
+pool_stats stats;
+
+/* Round BYTES up to its size class.  All classes are multiples of the huge
+   page size.  Above 16 MB there are four per power of two, so a buffer is at
+   most a quarter larger than needed; below, the step is one huge page, so
+   the waste is under 2 MB but a request between 1 and 2 MB may get up to
+   twice what it asked for.  */
+size_t size_class (size_t bytes)
+{
+	int bits = 0;
+	while ((size_t)1 << bits < bytes)
+		bits++;
+	size_t step = std::max (huge_page, (size_t)1 << std::max (bits - 3, 0));
+	return (bytes + step - 1) / step * step;
+}
+
+void *system_alloc (size_t bytes, size_t align)
+{
+#ifdef Q_OS_WIN
+	return _aligned_malloc (bytes, align);
+#else
+	void *p;
+	if (posix_memalign (&p, align, bytes) != 0)
+		return nullptr;
+#ifdef MADV_HUGEPAGE
+	if (align == huge_page)
+		madvise (p, bytes, MADV_HUGEPAGE);
+#endif
+	return p;
+#endif
+}
+
+void system_free (void *p)
+{
+#ifdef Q_OS_WIN
+	_aligned_free (p);
+#else
+	free (p);
+#endif
+}
+
+/* Called with the mutex held.  */
+void release_all ()
+{
+	for (auto &l: free_lists)
+		for (void *p: l.second)
+			system_free (p);
+	free_lists.clear ();
+	stats.bytes_free = 0;
+}
+
+struct image_block
+{
+	void *data;
+	size_t bytes;
+};
+
+void image_cleanup (void *info)
+{
+	image_block *b = (image_block *)info;
+	pool_free (b->data, b->bytes);
+	delete b;
+}
+
+}
+
+void *pool_alloc (size_t bytes)
+{
+	if (bytes < pool_min)
+		return system_alloc (std::max<size_t> (bytes, 1), 64);
+
+	size_t cls = size_class (bytes);
+	{
+		QMutexLocker lock (&pool_mutex);
+		auto it = free_lists.find (cls);
+		if (it != free_lists.end () && !it->second.empty ()) {
+			void *p = it->second.back ();
+			it->second.pop_back ();
+			stats.hits++;
+			stats.bytes_free -= cls;
+			stats.bytes_used += cls;
+			return p;
+		}
+		stats.misses++;
+	}
+	void *p = system_alloc (cls, huge_page);
+	if (p == nullptr) {
+		/* Unused buffers of other sizes may be what is in the way.  */
+		pool_trim ();
+		p = system_alloc (cls, huge_page);
+		if (p == nullptr)
+			return nullptr;
+	}
+	QMutexLocker lock (&pool_mutex);
+	stats.bytes_used += cls;
+	return p;
+}
+
+void pool_free (void *p, size_t bytes)
+{
+	if (p == nullptr)
+		return;
+	if (bytes < pool_min) {
+		system_free (p);
+		return;
+	}
+	size_t cls = size_class (bytes);
+	QMutexLocker lock (&pool_mutex);
+	stats.bytes_used -= cls;
+	if ((size_t)stats.bytes_free + cls > free_limit) {
+		system_free (p);
+		return;
+	}
+	free_lists[cls].push_back (p);
+	stats.bytes_free += cls;
+}
+
+void pool_trim ()
+{
+	QMutexLocker lock (&pool_mutex);
+	release_all ();
+}
+
+void pool_set_limit (size_t bytes)
+{
+	QMutexLocker lock (&pool_mutex);
+	free_limit = bytes;
+	if ((size_t)stats.bytes_free > free_limit)
+		release_all ();
+}
+
+pool_stats buffer_pool_stats ()
+{
+	QMutexLocker lock (&pool_mutex);
+	return stats;
+}
+
+QImage pooled_image (QSize sz, QImage::Format fmt)
+{
+	if (sz.isEmpty ())
+		return QImage ();
+	qsizetype bpl = ((qsizetype)sz.width () * QImage::toPixelFormat (fmt).bitsPerPixel () + 31) / 32 * 4;
+	size_t bytes = bpl * sz.height ();
+	uchar *data = (uchar *)pool_alloc (bytes);
+	if (data == nullptr)
+		return QImage ();
+	return QImage (data, sz.width (), sz.height (), bpl, fmt, image_cleanup, new image_block { data, bytes });
+}
@@ -0,0 +1,153 @@
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <vector>
+
+#include <QMutex>
+#include <QColorTransform>
+
+#include "parallel.h"
+#include "pipeline.h"
+#include "colorxform.h"
+
+namespace {
+
+struct cached_transform
+{
+	QColorSpace src, dst;
+	QColorTransform xform;
+	/* If not empty, the transform as a table per channel.  */
+	std::vector<uint16_t> lut;
+};
+
+/* Most recently used at the front.  An image viewer sees few distinct colour
+   spaces, so a short list is enough.  */
+constexpr size_t max_transforms = 16;
+QMutex cache_mutex;
+std::list<std::shared_ptr<const cached_transform>> cache;
+
+/* Run every 16 bit value through XFORM.  If each output channel depends only
+   on the same input channel, return the results as a table.  */
+std::vector<uint16_t> make_lut (const QColorSpace &src, const QColorTransform &xform)
+{
+	QImage ramp (65536, 1, QImage::Format_RGBA64);
+	uint16_t *p = (uint16_t *)ramp.bits ();
+	for (int i = 0; i < 65536; i++) {
+		p[4 * i] = p[4 * i + 1] = p[4 * i + 2] = i;
+		p[4 * i + 3] = 65535;
+	}
+	ramp.setColorSpace (src);
+	ramp.applyColorTransform (xform);
+
+	std::vector<uint16_t> lut (65536);
+	const uint16_t *q = (const uint16_t *)ramp.constBits ();
+	for (int i = 0; i < 65536; i++) {
+		/* With the same primaries, grey stays grey.  Anything else means the
+		   channels mix, and a table cannot represent the transform.  */
+		if (q[4 * i] != q[4 * i + 1] || q[4 * i] != q[4 * i + 2])
+			return std::vector<uint16_t> ();
+		lut[i] = q[4 * i];
+	}
+
+	/* Grey staying grey does not prove that Qt leaves the channels of other
+	   colours independent; its matrix may not be exactly the identity.  So
+	   also compare a grid of coloured pixels, and give up on the table if
+	   any of them differs.  */
+	constexpr int steps = 16;
+	/* Every combination of STEPS values in each channel.  */
+	QImage grid (steps * steps, steps, QImage::Format_RGBA64);
+	for (int y = 0; y < steps; y++) {
+		uint16_t *g = (uint16_t *)grid.scanLine (y);
+		for (int x = 0; x < steps * steps; x++, g += 4) {
+			g[0] = (x % steps) * 65535 / (steps - 1);
+			g[1] = (x / steps) * 65535 / (steps - 1);
+			g[2] = y * 65535 / (steps - 1);
+			g[3] = 65535;
+		}
+	}
+	QImage expected = grid;
+	expected.setColorSpace (src);
+	expected.applyColorTransform (xform);
+	for (int y = 0; y < steps; y++) {
+		const uint16_t *g = (const uint16_t *)grid.constScanLine (y);
+		const uint16_t *e = (const uint16_t *)expected.constScanLine (y);
+		for (int x = 0; x < 4 * steps * steps; x++)
+			if (x % 4 != 3 && lut[g[x]] != e[x])
+				return std::vector<uint16_t> ();
+	}
+	return lut;
+}
+
+/* The cached transform from SRC to DST, or null.  CACHE_MUTEX must be held.  */
+std::shared_ptr<const cached_transform> lookup (const QColorSpace &src, const QColorSpace &dst)
+{
+	for (auto it = cache.begin (); it != cache.end (); it++)
+		if ((*it)->src == src && (*it)->dst == dst) {
+			cache.splice (cache.begin (), cache, it);
+			return cache.front ();
+		}
+	return nullptr;
+}
+
+std::shared_ptr<const cached_transform> find_transform (const QColorSpace &src, const QColorSpace &dst)
+{
+	{
+		QMutexLocker lock (&cache_mutex);
+		if (auto t = lookup (src, dst))
+			return t;
+	}
+
+	/* Building the table takes a while, so do it without holding up other
+	   threads.  If two build the same transform, the first one to finish
+	   goes into the cache.  */
+	auto t = std::make_shared<cached_transform> ();
+	t->src = src;
+	t->dst = dst;
+	t->xform = src.transformationToColorSpace (dst);
+	bool same_primaries = (src.primaries () != QColorSpace::Primaries::Custom
+			       && src.primaries () == dst.primaries ());
+	if (same_primaries)
+		t->lut = make_lut (src, t->xform);
+
+	QMutexLocker lock (&cache_mutex);
+	if (auto other = lookup (src, dst))
+		return other;
+	cache.push_front (t);
+	if (cache.size () > max_transforms)
+		cache.pop_back ();
+	return t;
+}
+
+void convert_color_space (QImage &img, const QColorSpace &dst)
+{
+	/* Like convertToColorSpace, do nothing if there is nothing to convert from.  */
+	QColorSpace src = img.colorSpace ();
+	if (!src.isValid () || !dst.isValid () || src == dst)
+		return;
+	if (use_reference_pipeline) {
+		img.convertToColorSpace (dst);
+		return;
+	}
+
+	auto t = find_transform (src, dst);
+	if (t->lut.empty ())
+		img.applyColorTransform (t->xform);
+	else {
+		const uint16_t *lut = t->lut.data ();
+		int w = img.width ();
+		uchar *bits = img.bits ();
+		qsizetype bpl = img.bytesPerLine ();
+		parallel_for (img.height (), 64, [&] (int y0, int y1) {
+			for (int y = y0; y < y1; y++) {
+				uint16_t *p = (uint16_t *)(bits + y * bpl);
+				for (int x = 0; x < w; x++) {
+					p[0] = lut[p[0]];
+					p[1] = lut[p[1]];
+					p[2] = lut[p[2]];
+					p += 4;
+				}
+			}
+		});
+	}
+	img.setColorSpace (dst);
+}
@@ -0,0 +1,34 @@
+TEMPLATE	      = lib
+CONFIG		     += qt staticlib warn_on force_debug_info thread c++17
+
+# The image pipeline without any GUI: decoding, analysis, the colour tweaks,
+# colour space handling, geometry and resampling.  Only needs QtGui for
+# QImage, so it works without a display.
+
+HEADERS		      = ../include/bufpool.h \
+                        ../include/colors.h \
+                        ../include/colorxform.h \
+                        ../include/decode.h \
+                        ../include/geometry.h \
+                        ../include/linearbuf.h \
+                        ../include/parallel.h \
+                        ../include/pipeline.h \
+                        ../include/resample.h \
+                        ../include/strips.h \
+                        ../include/tweaks.h
+
+SOURCES		      = bufpool.cc colorxform.cc decode.cc geometry.cc linearbuf.cc parallel.cc pipeline.cc \
+                        reference.cc resample.cc strips.cc tweaks.cc
+
+TARGET                = equivcore
+
+*-g++ {
+QMAKE_CXXFLAGS += -fno-diagnostics-show-caret
+}
+
+INCLUDEPATH          += ../include
+
+release:DEFINES      += NO_CHECK
+win32:DEFINES        += QT_DLL QT_THREAD_SUPPORT HAVE_CONFIG_H _USE_MATH_DEFINES
+
+QT = core gui
@@ -0,0 +1,97 @@
+#include <cstdint>
+#include <algorithm>
+
+#include <QFile>
+#include <QColor>
+#include <QImageReader>
+#include <QCryptographicHash>
+
+#include "colors.h"
+#include "strips.h"
+#include "decode.h"
+
+QString encode_hash (const QByteArray &md5)
+{
+	return md5.toBase64 (QByteArray::Base64UrlEncoding | QByteArray::OmitTrailingEquals);
+}
+
+QString hash_file (const QString &path)
+{
+	QFile f (path);
+	if (!f.open (QIODevice::ReadOnly))
+		return QString ();
+	// MD5 is apparently quite bad, but it is supposed to be used to
+	// identify thumbnail files. If we ever want to support thumbnails,
+	// it makes little sense to compute two different hashes for the same file.
+	// So, stick with MD5. It's not like correct white balance is likely to
+	// be security relevant.
+	QCryptographicHash md5 (QCryptographicHash::Md5);
+	md5.addData (&f);
+	return encode_hash (md5.result ());
+}
+
+static decoded_image decode (QImageReader &reader, int max_dim)
+{
+	decoded_image r;
+	r.full_size = reader.size ();
+	QSize sz = r.full_size;
+	if (max_dim > 0 && sz.isValid () && std::max (sz.width (), sz.height ()) > max_dim)
+		sz.scale (max_dim, max_dim, Qt::KeepAspectRatio);
+	if (is_large_image (sz)) {
+		sz = limited_size (sz, large_image_pixels);
+		r.oversized = true;
+	}
+	if (sz != r.full_size)
+		reader.setScaledSize (sz);
+	r.image = reader.read ();
+	if (r.image.isNull ())
+		r.error = reader.errorString ();
+	if (!r.full_size.isValid ())
+		r.full_size = r.image.size ();
+	return r;
+}
+
+decoded_image decode_image (QIODevice *dev, const QByteArray &format, int max_dim)
+{
+	QImageReader reader (dev, format);
+	return decode (reader, max_dim);
+}
+
+decoded_image decode_image (const QString &path, int max_dim)
+{
+	QImageReader reader (path);
+	return decode (reader, max_dim);
+}
+
+void border_averages (const QImage &src, double &avgh, double &avgv)
+{
+	int w = src.width ();
+	int h = src.height ();
+	if (w <= 2 || h <= 2)
+		return;
+
+	uint64_t ravg = 0;
+	uint64_t gavg = 0;
+	uint64_t bavg = 0;
+	for (int x = 1; x < w - 1; x++) {
+		QColor c1 = src.pixel (x, 0);
+		QColor c2 = src.pixel (x, h - 1);
+		ravg += c1.red () + c2.red ();
+		gavg += c1.green () + c2.green ();
+		bavg += c1.blue () + c2.blue ();
+	}
+	avgh = ravg * l_factor_r + gavg * l_factor_g + bavg * l_factor_b;
+	avgh /= 2 * (w - 2);
+	avgh /= 255;
+	ravg = gavg = bavg = 0;
+	for (int y = 0; y < h; y++) {
+		QColor c1 = src.pixel (0, y);
+		QColor c2 = src.pixel (w - 1, y);
+		ravg += c1.red () + c2.red ();
+		gavg += c1.green () + c2.green ();
+		bavg += c1.blue () + c2.blue ();
+	}
+	avgv = ravg * l_factor_r + gavg * l_factor_g + bavg * l_factor_b;
+	avgv /= 2 * h;
+	avgv /= 255;
+}
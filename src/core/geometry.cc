@@ -0,0 +1,97 @@
+#include <cstdint>
+#include <algorithm>
+
+#include "geometry.h"
+#include "parallel.h"
+#include "bufpool.h"
+
+/* Tiles are square blocks of source pixels.  Within a tile, the destination
+   addresses of a rotated row are a column apart, so the tile size is chosen
+   to keep the destination lines touched by one tile in L1.  */
+constexpr int tile_bytes = 256;
+
+template<class T>
+static void rotate_pixels (const uchar *src_bits, qsizetype src_bpl, int w, int h,
+			   uchar *dst_bits, qsizetype dst_bpl, int rot, bool mirror)
+{
+	qsizetype dstride = dst_bpl / sizeof (T);
+	/* The destination coordinates of source pixel (x, y) are an affine function.
+	   First mirror, then rotate clockwise.  */
+	int ax = mirror ? -1 : 1, cx = mirror ? w - 1 : 0;
+	qsizetype step_x, step_y, base;
+	switch (rot) {
+	default:
+		/* Destination (x', y).  */
+		step_x = ax;
+		step_y = dstride;
+		base = cx;
+		break;
+	case 90:
+		/* Destination (h - 1 - y, x').  */
+		step_x = ax * dstride;
+		step_y = -1;
+		base = cx * dstride + h - 1;
+		break;
+	case 180:
+		/* Destination (w - 1 - x', h - 1 - y).  */
+		step_x = -ax;
+		step_y = -dstride;
+		base = (h - 1) * dstride + w - 1 - cx;
+		break;
+	case 270:
+		/* Destination (y, w - 1 - x').  */
+		step_x = -ax * dstride;
+		step_y = 1;
+		base = (w - 1 - cx) * dstride;
+		break;
+	}
+
+	constexpr int tile = tile_bytes / sizeof (T);
+	int tiles_y = (h + tile - 1) / tile;
+	T *dst = (T *)dst_bits;
+	parallel_for (tiles_y, 1, [=] (int ty0, int ty1) {
+		for (int ty = ty0; ty < ty1; ty++) {
+			int y0 = ty * tile;
+			int y1 = std::min (h, y0 + tile);
+			for (int x0 = 0; x0 < w; x0 += tile) {
+				int x1 = std::min (w, x0 + tile);
+				for (int y = y0; y < y1; y++) {
+					const T *s = (const T *)(src_bits + y * src_bpl) + x0;
+					T *d = dst + base + y * step_y + x0 * step_x;
+					for (int x = x0; x < x1; x++) {
+						*d = *s++;
+						d += step_x;
+					}
+				}
+			}
+		}
+	});
+}
+
+QImage rotate_image (const QImage &src, int rot, bool mirror)
+{
+	rot = ((rot % 360) + 360) % 360;
+	if ((rot == 0 && !mirror) || src.isNull ())
+		return src;
+
+	if (src.depth () != 32 && src.depth () != 64)
+		return rotate_image (src.convertToFormat (src.hasAlphaChannel () ? QImage::Format_ARGB32 : QImage::Format_RGB32),
+				     rot, mirror);
+
+	int w = src.width ();
+	int h = src.height ();
+	QImage dst = pooled_image (rotated_size (src.size (), rot), src.format ());
+	if (dst.isNull ())
+		return dst;
+	dst.setColorSpace (src.colorSpace ());
+	dst.setDotsPerMeterX (rot == 90 || rot == 270 ? src.dotsPerMeterY () : src.dotsPerMeterX ());
+	dst.setDotsPerMeterY (rot == 90 || rot == 270 ? src.dotsPerMeterX () : src.dotsPerMeterY ());
+
+	if (src.depth () == 32)
+		rotate_pixels<uint32_t> (src.constBits (), src.bytesPerLine (), w, h,
+					 dst.bits (), dst.bytesPerLine (), rot, mirror);
+	else
+		rotate_pixels<uint64_t> (src.constBits (), src.bytesPerLine (), w, h,
+					 dst.bits (), dst.bytesPerLine (), rot, mirror);
+	return dst;
+}
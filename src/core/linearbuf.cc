@@ -0,0 +1,61 @@
+#include <new>
+
+#include "parallel.h"
+#include "bufpool.h"
+#include "linearbuf.h"
+
+/* A cache line, and enough for any vector unit.  */
+constexpr size_t row_align = 64;
+
+linear_buffer::linear_buffer (QSize sz, bool has_alpha, const QColorSpace &cs)
+	: m_width (sz.width ()), m_height (sz.height ()), m_planes (has_alpha ? 4 : 3), m_cs (cs)
+{
+	constexpr qsizetype per_align = row_align / sizeof (uint16_t);
+	m_stride = (m_width + per_align - 1) / per_align * per_align;
+	size_t bytes = m_planes * m_stride * m_height * sizeof (uint16_t);
+	uint16_t *p = (uint16_t *)pool_alloc (bytes);
+	if (p == nullptr)
+		throw std::bad_alloc ();
+	m_data = std::shared_ptr<uint16_t> (p, [bytes] (uint16_t *q) { pool_free (q, bytes); });
+}
+
+linear_buffer linear_buffer::from_image (const QImage &linear, bool has_alpha)
+{
+	linear_buffer buf (linear.size (), has_alpha, linear.colorSpace ());
+	int w = buf.m_width;
+	parallel_for (buf.m_height, 64, [&] (int y0, int y1) {
+		for (int y = y0; y < y1; y++) {
+			const uint16_t *src = (const uint16_t *)linear.constScanLine (y);
+			for (int c = 0; c < buf.m_planes; c++) {
+				uint16_t *dst = buf.row (c, y);
+				for (int x = 0; x < w; x++)
+					dst[x] = src[4 * x + c];
+			}
+		}
+	});
+	return buf;
+}
+
+QImage linear_buffer::to_image () const
+{
+	QImage img (size (), QImage::Format_RGBA64);
+	img.setColorSpace (m_cs);
+	uchar *bits = img.bits ();
+	qsizetype bpl = img.bytesPerLine ();
+	parallel_for (m_height, 64, [&] (int y0, int y1) {
+		for (int y = y0; y < y1; y++) {
+			uint16_t *dst = (uint16_t *)(bits + y * bpl);
+			for (int c = 0; c < 4; c++) {
+				if (c == alpha && !has_alpha ()) {
+					for (int x = 0; x < m_width; x++)
+						dst[4 * x + c] = 65535;
+					continue;
+				}
+				const uint16_t *src = row (c, y);
+				for (int x = 0; x < m_width; x++)
+					dst[4 * x + c] = src[x];
+			}
+		}
+	});
+	return img;
+}
@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <QThreadPool>
+#include <QSemaphore>
+#include <QRunnable>
+
+#include "parallel.h"
+
+namespace {
+
+class range_runner : public QRunnable
+{
+	const std::function<void (int, int)> &m_func;
+	QSemaphore *m_sem;
+	int m_start, m_end;
+
+public:
+	range_runner (const std::function<void (int, int)> &f, QSemaphore *sem, int start, int end)
+		: m_func (f), m_sem (sem), m_start (start), m_end (end)
+	{
+		/* Owned by parallel_for, which may take it back from the pool.  */
+		setAutoDelete (false);
+	}
+
+	void run () override
+	{
+		m_func (m_start, m_end);
+		m_sem->release ();
+	}
+};
+
+}
+
+void parallel_for (int n, int grain, const std::function<void (int, int)> &f)
+{
+	if (n <= 0)
+		return;
+
+	QThreadPool *pool = QThreadPool::globalInstance ();
+	int nthreads = std::max (1, pool->maxThreadCount ());
+	grain = std::max (1, grain);
+	/* A few more chunks than threads, to even out the load.  */
+	int chunks = std::min (nthreads * 3, (n + grain - 1) / grain);
+	if (chunks <= 1) {
+		f (0, n);
+		return;
+	}
+
+	QSemaphore sem;
+	std::vector<std::unique_ptr<range_runner>> runners;
+	for (int i = 1; i < chunks; i++) {
+		int start = (long)n * i / chunks;
+		int end = (long)n * (i + 1) / chunks;
+		runners.emplace_back (new range_runner (f, &sem, start, end));
+		pool->start (runners.back ().get ());
+	}
+	f (0, n / chunks);
+
+	/* Run whatever the pool has not picked up yet ourselves.  */
+	for (auto &r: runners)
+		if (pool->tryTake (r.get ()))
+			r->run ();
+	sem.acquire (chunks - 1);
+}
@@ -0,0 +1,245 @@
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#include <QMutex>
+#include <QColorSpace>
+
+#include "tweaks.h"
+#include "colors.h"
+#include "geometry.h"
+#include "colorxform.h"
+#include "parallel.h"
+#include "bufpool.h"
+#include "pipeline.h"
+
+/* 8 bit sRGB images decode straight to linear through a table, without
+   widening to 16 bits first and converting in a second pass.  */
+static linear_buffer linear_from_srgb8 (const QImage &src)
+{
+	linear_buffer linear (src.size (), src.hasAlphaChannel (),
+			      QColorSpace (QColorSpace::SRgb).withTransferFunction (QColorSpace::TransferFunction::Linear));
+	const uint16_t *lut = srgb_table.to_linear16;
+	int w = src.width ();
+	const uchar *sbits = src.constBits ();
+	qsizetype sbpl = src.bytesPerLine ();
+	parallel_for (src.height (), 64, [&] (int y0, int y1) {
+		for (int y = y0; y < y1; y++) {
+			const QRgb *p = (const QRgb *)(sbits + y * sbpl);
+			uint16_t *r = linear.row (linear_buffer::red, y);
+			uint16_t *g = linear.row (linear_buffer::green, y);
+			uint16_t *b = linear.row (linear_buffer::blue, y);
+			for (int x = 0; x < w; x++) {
+				r[x] = lut[qRed (p[x])];
+				g[x] = lut[qGreen (p[x])];
+				b[x] = lut[qBlue (p[x])];
+			}
+			if (linear.has_alpha ()) {
+				uint16_t *a = linear.row (linear_buffer::alpha, y);
+				for (int x = 0; x < w; x++)
+					a[x] = qAlpha (p[x]) * 257;
+			}
+		}
+	});
+	return linear;
+}
+
+linear_buffer linear_image (const QImage &src, int cspace_idx)
+{
+	QColorSpace cs = cspace_idx != 0 ? QColorSpace ((QColorSpace::NamedColorSpace)cspace_idx) : src.colorSpace ();
+	bool srgb = !cs.isValid () || cs == QColorSpace (QColorSpace::SRgb);
+	if (srgb && !use_reference_pipeline
+	    && (src.format () == QImage::Format_RGB32 || src.format () == QImage::Format_ARGB32))
+		return linear_from_srgb8 (src);
+
+	QImage linear = src.convertToFormat (QImage::Format_RGBA64);
+	if (cspace_idx != 0)
+		linear.setColorSpace ((QColorSpace::NamedColorSpace)cspace_idx);
+	else if (!linear.colorSpace ().isValid ())
+		linear.setColorSpace (QColorSpace::SRgb);
+	QColorSpace linear_cs = linear.colorSpace ();
+	linear_cs.setTransferFunction (QColorSpace::TransferFunction::Linear);
+	convert_color_space (linear, linear_cs);
+	return linear_buffer::from_image (linear, src.hasAlphaChannel ());
+}
+
+void merge_stats (linear_stats &st, const linear_stats &other)
+{
+	st.maxr = std::max (st.maxr, other.maxr);
+	st.maxg = std::max (st.maxg, other.maxg);
+	st.maxb = std::max (st.maxb, other.maxb);
+	st.minr = std::min (st.minr, other.minr);
+	st.ming = std::min (st.ming, other.ming);
+	st.minb = std::min (st.minb, other.minb);
+	st.minavg = std::min (st.minavg, other.minavg);
+}
+
+linear_stats measure_linear (const linear_buffer &linear)
+{
+	if (use_reference_pipeline)
+		return reference_measure_linear (linear.to_image ());
+
+	linear_stats st;
+	QMutex st_mutex;
+	int w = linear.width ();
+	parallel_for (linear.height (), 64, [&] (int y0, int y1) {
+		linear_stats part;
+		for (int y = y0; y < y1; y++) {
+			const uint16_t *pr = linear.row (linear_buffer::red, y);
+			const uint16_t *pg = linear.row (linear_buffer::green, y);
+			const uint16_t *pb = linear.row (linear_buffer::blue, y);
+			for (int x = 0; x < w; x++) {
+				int r = pr[x], g = pg[x], b = pb[x];
+				part.maxr = std::max (r, part.maxr);
+				part.maxg = std::max (g, part.maxg);
+				part.maxb = std::max (b, part.maxb);
+				part.minr = std::min (r, part.minr);
+				part.ming = std::min (g, part.ming);
+				part.minb = std::min (b, part.minb);
+				int avg = (r + b + g) / 3;
+				part.minavg = std::min (avg, part.minavg);
+			}
+		}
+		QMutexLocker lock (&st_mutex);
+		merge_stats (st, part);
+	});
+	return st;
+}
+
+namespace {
+
+/* An img_tweaks value compiled for one image.  Everything that does not
+   depend on the pixel is worked out once, and the kernel is chosen by which
+   stages are not the identity.  The arithmetic is that of
+   reference_tweak_linear, operation for operation, so the results match.  */
+struct tweak_program
+{
+	/* Each channel becomes clamp (v * f * scale - black).  */
+	double fr, fg, fb;
+	float scale;
+	uint64_t black;
+	/* Mix with the luminance, if nonzero.  */
+	double satval;
+	/* The gamma curve as a table of all 16 bit values, empty if there is
+	   no gamma.  */
+	std::vector<uint16_t> gamma_lut;
+};
+
+tweak_program compile_tweaks (const img_tweaks &tw, const linear_stats &st)
+{
+	tweak_program p;
+	int wr = std::max (1, tw.white.red ());
+	int wg = std::max (1, tw.white.green ());
+	int wb = std::max (1, tw.white.blue ());
+	int wmax = std::max ({wr, wg, wb});
+	p.fr = (double)wmax / wr;
+	p.fg = (double)wmax / wg;
+	p.fb = (double)wmax / wb;
+
+	double rlimit = 65535. / (st.maxr * p.fr);
+	double glimit = 65535. / (st.maxg * p.fg);
+	double blimit = 65535. / (st.maxb * p.fb);
+	double limit = std::min ({ 1.0, rlimit, glimit, blimit });
+
+	double bright = 1 + tw.brightness / 100.;
+	p.black = tw.blacklevel * 256;
+	p.scale = bright * 65536. / (65536. - p.black);
+	p.scale *= limit;
+	p.black *= p.scale;
+
+	p.satval = -tw.sat / 100.;
+	double gammaval = 1 + tw.gamma / 100.1;
+	if (gammaval != 1) {
+		p.gamma_lut.resize (65536);
+		for (int i = 0; i < 65536; i++)
+			p.gamma_lut[i] = (int)(pow (i / 65535., gammaval) * 65535);
+	}
+	return p;
+}
+
+/* Tweak N pixels from the planes of a linear_buffer into DST, in the layout
+   of Format_RGBA64.  A is null if there is no alpha plane.  */
+template<bool sat, bool gamma>
+void run_tweaks (const tweak_program &p, const uint16_t *pr, const uint16_t *pg, const uint16_t *pb,
+		 const uint16_t *pa, uint16_t *dst, int n)
+{
+	const uint16_t *lut = p.gamma_lut.data ();
+	for (int i = 0; i < n; i++) {
+		int r = std::clamp ((int)(pr[i] * p.fr * p.scale - p.black), 0, 65535);
+		int g = std::clamp ((int)(pg[i] * p.fg * p.scale - p.black), 0, 65535);
+		int b = std::clamp ((int)(pb[i] * p.fb * p.scale - p.black), 0, 65535);
+		if (sat) {
+			int lumi = r * l_factor_r + g * l_factor_g + b * l_factor_b;
+			r = std::clamp ((int)(r + p.satval * (lumi - r)), 0, 65535);
+			g = std::clamp ((int)(g + p.satval * (lumi - g)), 0, 65535);
+			b = std::clamp ((int)(b + p.satval * (lumi - b)), 0, 65535);
+		}
+		if (gamma) {
+			r = lut[r];
+			g = lut[g];
+			b = lut[b];
+		}
+		dst[0] = r;
+		dst[1] = g;
+		dst[2] = b;
+		dst[3] = pa ? pa[i] : 65535;
+		dst += 4;
+	}
+}
+
+}
+
+QImage tweak_linear (const linear_buffer &linear, const img_tweaks &tw, const linear_stats &st)
+{
+	if (use_reference_pipeline)
+		return reference_tweak_linear (linear.to_image (), tw, st);
+
+	if (!tw.changes_colours ())
+		return linear.to_image ();
+
+	tweak_program p = compile_tweaks (tw, st);
+	auto kernel = (p.satval != 0
+		       ? (p.gamma_lut.empty () ? run_tweaks<true, false> : run_tweaks<true, true>)
+		       : (p.gamma_lut.empty () ? run_tweaks<false, false> : run_tweaks<false, true>));
+	QImage tmp = pooled_image (linear.size (), QImage::Format_RGBA64);
+	tmp.setColorSpace (linear.color_space ());
+	int w = tmp.width ();
+	uchar *bits = tmp.bits ();
+	qsizetype bpl = tmp.bytesPerLine ();
+	parallel_for (tmp.height (), 64, [&] (int y0, int y1) {
+		for (int y = y0; y < y1; y++)
+			kernel (p, linear.row (linear_buffer::red, y), linear.row (linear_buffer::green, y),
+				linear.row (linear_buffer::blue, y),
+				linear.has_alpha () ? linear.row (linear_buffer::alpha, y) : nullptr,
+				(uint16_t *)(bits + y * bpl), w);
+	});
+	return tmp;
+}
+
+QImage apply_tweaks (const linear_buffer &linear, const img_tweaks &tw, const linear_stats &st)
+{
+	QImage tmp = tweak_linear (linear, tw, st);
+	convert_color_space (tmp, QColorSpace::SRgb);
+	return tmp;
+}
+
+QImage untweaked_image (const QImage &src, const img_tweaks &tw)
+{
+	if (use_reference_pipeline || tw.changes_colours ())
+		return QImage ();
+	QColorSpace srgb (QColorSpace::SRgb);
+	if (tw.cspace_idx != 0 ? tw.cspace_idx != QColorSpace::SRgb
+	    : src.colorSpace ().isValid () && src.colorSpace () != srgb)
+		return QImage ();
+	QImage img = src.convertToFormat (QImage::Format_ARGB32);
+	img.setColorSpace (srgb);
+	return img;
+}
+
+QImage render_full (const QImage &src, const img_tweaks &tw)
+{
+	linear_buffer linear = linear_image (src, tw.cspace_idx);
+	linear_stats st = measure_linear (linear);
+	return rotate_image (apply_tweaks (linear, tw, st), tw.rot, tw.mirrored);
+}
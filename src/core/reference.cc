@@ -0,0 +1,127 @@
+/*
+ *   reference.cc - the pixel loops of the colour pipeline in their original,
+ *   straightforward form.
+ *
+ *   Optimised versions in pipeline.cc must produce exactly the same results;
+ *   equiv-bench --verify compares them.  Setting use_reference_pipeline makes
+ *   the program use these instead, which helps to find out whether a
+ *   problem is caused by an optimisation.  Do not optimise this file.
+ */
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include <QColorSpace>
+
+#include "tweaks.h"
+#include "colors.h"
+#include "pipeline.h"
+
+bool use_reference_pipeline = false;
+
+/* Colour space conversions are left to Qt here, without the caching and
+   tables of convert_color_space.  */
+QImage reference_linear_image (const QImage &src, int cspace_idx)
+{
+	QImage linear = src.convertToFormat (QImage::Format_RGBA64);
+	if (cspace_idx != 0)
+		linear.setColorSpace ((QColorSpace::NamedColorSpace)cspace_idx);
+	else if (!linear.colorSpace ().isValid ())
+		linear.setColorSpace (QColorSpace::SRgb);
+	QColorSpace linear_cs = linear.colorSpace ();
+	linear_cs.setTransferFunction (QColorSpace::TransferFunction::Linear);
+	linear.convertToColorSpace (linear_cs);
+	return linear;
+}
+
+linear_stats reference_measure_linear (const QImage &linear)
+{
+	linear_stats st;
+	const uint64_t *bits = (const uint64_t *)linear.constBits ();
+	QSize sz = linear.size ();
+	long count = (long)sz.width () * (long)sz.height ();
+	for (long i = 0; i < count; i++) {
+		/* Format_RGBA64 keeps red in the low bits, as reference_tweak_linear
+		   reads it.  */
+		uint64_t v = *bits;
+		int r = v & 65535;
+		v >>= 16;
+		int g = v & 65535;
+		v >>= 16;
+		int b = v & 65535;
+
+		st.maxr = std::max (r, st.maxr);
+		st.maxg = std::max (g, st.maxg);
+		st.maxb = std::max (b, st.maxb);
+		st.minr = std::min (r, st.minr);
+		st.ming = std::min (g, st.ming);
+		st.minb = std::min (b, st.minb);
+		int avg = (r + b + g) / 3;
+		st.minavg = std::min (avg, st.minavg);
+		bits++;
+	}
+	return st;
+}
+
+QImage reference_tweak_linear (const QImage &linear, const img_tweaks &tw, const linear_stats &st)
+{
+	int wr = std::max (1, tw.white.red ());
+	int wg = std::max (1, tw.white.green ());
+	int wb = std::max (1, tw.white.blue ());
+	int wmax = std::max ({wr, wg, wb});
+	double fr = (double)wmax / wr;
+	double fg = (double)wmax / wg;
+	double fb = (double)wmax / wb;
+
+	double rlimit = 65535. / (st.maxr * fr);
+	double glimit = 65535. / (st.maxg * fg);
+	double blimit = 65535. / (st.maxb * fb);
+	double limit = std::min ({ 1.0, rlimit, glimit, blimit });
+
+	QImage tmp = linear;
+	double gammaval = 1 + tw.gamma / 100.1;
+	double satval = -tw.sat / 100.;
+	double bright = 1 + tw.brightness / 100.;
+
+	if (tw.blacklevel != 0 || tw.brightness != 0 || tw.sat != 0 || tw.gamma != 0 || tw.white != Qt::white) {
+		auto bits1 = tmp.bits ();
+		uint64_t *bits = (uint64_t *)bits1;
+		QSize sz = tmp.size ();
+		long count = (long)sz.width () * (long)sz.height ();
+		uint64_t black = tw.blacklevel * 256;
+		float scale = bright * 65536. / (65536. - black);
+		scale *= limit;
+		black *= scale;
+		for (long i = 0; i < count; i++) {
+			uint64_t v = *bits;
+			int r = v & 65535;
+			v >>= 16;
+			int g = v & 65535;
+			v >>= 16;
+			int b = v & 65535;
+			v >>= 16;
+			r = std::clamp ((int)(r * fr * scale - black), 0, 65535);
+			g = std::clamp ((int)(g * fg * scale - black), 0, 65535);
+			b = std::clamp ((int)(b * fb * scale - black), 0, 65535);
+
+			if (satval != 0) {
+				int lumi = r * l_factor_r + g * l_factor_g + b * l_factor_b;
+				r = std::clamp ((int)(r + satval * (lumi - r)), 0, 65535);
+				g = std::clamp ((int)(g + satval * (lumi - g)), 0, 65535);
+				b = std::clamp ((int)(b + satval * (lumi - b)), 0, 65535);
+			}
+			if (gammaval != 1) {
+				r = pow (r / 65535., gammaval) * 65535;
+				g = pow (g / 65535., gammaval) * 65535;
+				b = pow (b / 65535., gammaval) * 65535;
+			}
+			v <<= 32;
+			v |= b << 16;
+			v |= g;
+			v <<= 16;
+			v |= r;
+			*bits++ = v;
+		}
+	}
+	return tmp;
+}
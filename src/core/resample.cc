@@ -0,0 +1,307 @@
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "colors.h"
+#include "resample.h"
+#include "parallel.h"
+#include "bufpool.h"
+
+/* Internally, every pixel is four 16-bit linear values in the memory order of
+   Format_RGBA64: red, green, blue, alpha.  */
+
+namespace {
+
+/* For every destination pixel along one axis, the first source pixel that contributes
+   to it, and the weights of up to max_taps source pixels from there on.  */
+struct filter_taps
+{
+	int max_taps = 0;
+	std::vector<int> start;
+	std::vector<int> count;
+	std::vector<float> weights;
+
+	filter_taps (int src_n, int dst_n);
+	const float *weights_for (int i) const { return &weights[(size_t)i * max_taps]; }
+};
+
+double lanczos3 (double x)
+{
+	x = fabs (x);
+	if (x < 1e-9)
+		return 1;
+	if (x >= 3)
+		return 0;
+	double px = M_PI * x;
+	return 3 * sin (px) * sin (px / 3) / (px * px);
+}
+
+filter_taps::filter_taps (int src_n, int dst_n)
+	: start (dst_n), count (dst_n)
+{
+	double scale = (double)dst_n / src_n;
+	std::vector<std::vector<double>> all (dst_n);
+	for (int i = 0; i < dst_n; i++) {
+		std::vector<double> &w = all[i];
+		int first;
+		if (scale < 1) {
+			/* Area average: destination pixel I covers [LO, HI) in the source.  */
+			double lo = i / scale;
+			double hi = (i + 1) / scale;
+			first = std::min (src_n - 1, (int)floor (lo));
+			int last = std::min (src_n - 1, (int)ceil (hi) - 1);
+			for (int j = first; j <= last; j++)
+				w.push_back (std::min (hi, j + 1.) - std::max (lo, (double)j));
+		} else {
+			double center = (i + 0.5) / scale - 0.5;
+			int c = floor (center);
+			first = std::max (0, c - 2);
+			int last = std::min (src_n - 1, c + 3);
+			w.resize (last - first + 1);
+			/* Taps beyond the edges are folded onto the edge pixels.  */
+			for (int j = c - 2; j <= c + 3; j++)
+				w[std::clamp (j, first, last) - first] += lanczos3 (center - j);
+		}
+		double sum = 0;
+		for (auto v: w)
+			sum += v;
+		for (auto &v: w)
+			v /= sum;
+		start[i] = first;
+		count[i] = w.size ();
+		max_taps = std::max (max_taps, count[i]);
+	}
+	weights.resize ((size_t)dst_n * max_taps);
+	for (int i = 0; i < dst_n; i++)
+		std::copy (all[i].begin (), all[i].end (), weights.begin () + (size_t)i * max_taps);
+}
+
+/* Alpha is premultiplied while filtering, so that the colour of transparent
+   pixels does not bleed into their neighbours.  */
+inline uint16_t premultiply (uint32_t v, uint32_t a)
+{
+	return (v * a + 32767) / 65535;
+}
+
+inline uint16_t unpremultiply (uint32_t v, uint32_t a)
+{
+	if (a == 0)
+		return 0;
+	return std::min<uint32_t> (65535, (v * 65535 + a / 2) / a);
+}
+
+void to_linear_row (const uchar *src, QImage::Format fmt, int w, bool premul, uint16_t *dst)
+{
+	if (fmt == QImage::Format_RGBA64) {
+		std::copy ((const uint16_t *)src, (const uint16_t *)src + 4 * w, dst);
+		if (premul)
+			for (int x = 0; x < w; x++, dst += 4)
+				for (int c = 0; c < 3; c++)
+					dst[c] = premultiply (dst[c], dst[3]);
+		return;
+	}
+	const uint16_t *lut = srgb_table.to_linear16;
+	const uint32_t *s = (const uint32_t *)src;
+	for (int x = 0; x < w; x++) {
+		uint32_t v = s[x];
+		uint32_t a = (v >> 24) * 257;
+		dst[0] = lut[(v >> 16) & 255];
+		dst[1] = lut[(v >> 8) & 255];
+		dst[2] = lut[v & 255];
+		dst[3] = a;
+		if (premul)
+			for (int c = 0; c < 3; c++)
+				dst[c] = premultiply (dst[c], a);
+		dst += 4;
+	}
+}
+
+void from_linear_row (const uint16_t *src, QImage::Format fmt, int w, bool premul, uchar *dst)
+{
+	if (fmt == QImage::Format_RGBA64) {
+		uint16_t *d = (uint16_t *)dst;
+		std::copy (src, src + 4 * w, d);
+		if (premul)
+			for (int x = 0; x < w; x++, d += 4)
+				for (int c = 0; c < 3; c++)
+					d[c] = unpremultiply (d[c], d[3]);
+		return;
+	}
+	const uint8_t *lut = srgb_table.to_srgb8;
+	uint32_t *d = (uint32_t *)dst;
+	for (int x = 0; x < w; x++) {
+		uint32_t r = src[0], g = src[1], b = src[2];
+		if (premul) {
+			r = unpremultiply (r, src[3]);
+			g = unpremultiply (g, src[3]);
+			b = unpremultiply (b, src[3]);
+		}
+		uint32_t a = (src[3] * 255 + 32767) / 65535;
+		d[x] = (a << 24) | (lut[r] << 16) | (lut[g] << 8) | lut[b];
+		src += 4;
+	}
+}
+
+#ifdef __SSE2__
+
+inline __m128 load_px (const uint16_t *p)
+{
+	__m128i v = _mm_loadl_epi64 ((const __m128i *)p);
+	return _mm_cvtepi32_ps (_mm_unpacklo_epi16 (v, _mm_setzero_si128 ()));
+}
+
+/* Round and clamp four floats to unsigned 16 bit.  SSE2 has no unsigned saturating
+   pack from 32 bit, so bias into the signed range and back.  */
+inline __m128i pack_px (__m128 lo, __m128 hi)
+{
+	const __m128 vmax = _mm_set1_ps (65535.f);
+	const __m128i bias = _mm_set1_epi32 (32768);
+	lo = _mm_min_ps (_mm_max_ps (lo, _mm_setzero_ps ()), vmax);
+	hi = _mm_min_ps (_mm_max_ps (hi, _mm_setzero_ps ()), vmax);
+	__m128i ilo = _mm_sub_epi32 (_mm_cvtps_epi32 (lo), bias);
+	__m128i ihi = _mm_sub_epi32 (_mm_cvtps_epi32 (hi), bias);
+	return _mm_add_epi16 (_mm_packs_epi32 (ilo, ihi), _mm_set1_epi16 ((short)0x8000));
+}
+
+void filter_row_h (const uint16_t *src, const filter_taps &taps, int dst_w, uint16_t *dst)
+{
+	for (int x = 0; x < dst_w; x++) {
+		const uint16_t *s = src + 4 * taps.start[x];
+		const float *w = taps.weights_for (x);
+		int n = taps.count[x];
+		__m128 acc = _mm_setzero_ps ();
+		for (int k = 0; k < n; k++)
+			acc = _mm_add_ps (acc, _mm_mul_ps (_mm_set1_ps (w[k]), load_px (s + 4 * k)));
+		_mm_storel_epi64 ((__m128i *)(dst + 4 * x), pack_px (acc, acc));
+	}
+}
+
+void accumulate_row_v (float *acc, const uint16_t *src, float weight, int n)
+{
+	const __m128 vw = _mm_set1_ps (weight);
+	const __m128i zero = _mm_setzero_si128 ();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128 ((const __m128i *)(src + i));
+		__m128 lo = _mm_cvtepi32_ps (_mm_unpacklo_epi16 (v, zero));
+		__m128 hi = _mm_cvtepi32_ps (_mm_unpackhi_epi16 (v, zero));
+		_mm_storeu_ps (acc + i, _mm_add_ps (_mm_loadu_ps (acc + i), _mm_mul_ps (vw, lo)));
+		_mm_storeu_ps (acc + i + 4, _mm_add_ps (_mm_loadu_ps (acc + i + 4), _mm_mul_ps (vw, hi)));
+	}
+	for (; i < n; i++)
+		acc[i] += weight * src[i];
+}
+
+void store_row_v (const float *acc, uint16_t *dst, int n)
+{
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm_storeu_si128 ((__m128i *)(dst + i), pack_px (_mm_loadu_ps (acc + i), _mm_loadu_ps (acc + i + 4)));
+	for (; i < n; i++)
+		dst[i] = lrintf (std::clamp (acc[i], 0.f, 65535.f));
+}
+
+#else
+
+void filter_row_h (const uint16_t *src, const filter_taps &taps, int dst_w, uint16_t *dst)
+{
+	for (int x = 0; x < dst_w; x++) {
+		const uint16_t *s = src + 4 * taps.start[x];
+		const float *w = taps.weights_for (x);
+		int n = taps.count[x];
+		float acc[4] = { 0, 0, 0, 0 };
+		for (int k = 0; k < n; k++)
+			for (int c = 0; c < 4; c++)
+				acc[c] += w[k] * s[4 * k + c];
+		for (int c = 0; c < 4; c++)
+			dst[4 * x + c] = lrintf (std::clamp (acc[c], 0.f, 65535.f));
+	}
+}
+
+void accumulate_row_v (float *acc, const uint16_t *src, float weight, int n)
+{
+	for (int i = 0; i < n; i++)
+		acc[i] += weight * src[i];
+}
+
+void store_row_v (const float *acc, uint16_t *dst, int n)
+{
+	for (int i = 0; i < n; i++)
+		dst[i] = lrintf (std::clamp (acc[i], 0.f, 65535.f));
+}
+
+#endif
+
+}
+
+QImage resample_image (const QImage &src_in, QSize sz)
+{
+	if (src_in.isNull () || sz.isEmpty ())
+		return QImage ();
+
+	/* The tables decode straight sRGB values, so premultiplied sources are
+	   converted too; their alpha is multiplied in again in linear light.  */
+	QImage src = src_in;
+	QImage::Format fmt = src.format ();
+	if (fmt != QImage::Format_ARGB32 && fmt != QImage::Format_RGB32 && fmt != QImage::Format_RGBA64) {
+		fmt = QImage::Format_ARGB32;
+		src = src.convertToFormat (fmt);
+	}
+	if (src.size () == sz)
+		return src;
+	bool premul = src.hasAlphaChannel ();
+
+	int src_w = src.width ();
+	int src_h = src.height ();
+	int dst_w = sz.width ();
+	int dst_h = sz.height ();
+
+	QImage dst = pooled_image (sz, fmt);
+	if (dst.isNull ())
+		return dst;
+	dst.setColorSpace (src.colorSpace ());
+
+	/* Horizontal pass first, into an intermediate image of SRC_H rows of DST_W pixels.  */
+	pool_array<uint16_t> inter ((size_t)src_h * dst_w * 4);
+	filter_taps htaps (src_w, dst_w);
+	parallel_for (src_h, 16, [&] (int y0, int y1) {
+		std::vector<uint16_t> row ((size_t)src_w * 4);
+		for (int y = y0; y < y1; y++) {
+			uint16_t *out = &inter[(size_t)y * dst_w * 4];
+			if (src_w == dst_w) {
+				to_linear_row (src.constScanLine (y), fmt, src_w, premul, out);
+				continue;
+			}
+			to_linear_row (src.constScanLine (y), fmt, src_w, premul, row.data ());
+			filter_row_h (row.data (), htaps, dst_w, out);
+		}
+	});
+
+	filter_taps vtaps (src_h, dst_h);
+	uchar *dst_bits = dst.bits ();
+	qsizetype dst_bpl = dst.bytesPerLine ();
+	parallel_for (dst_h, 8, [&] (int y0, int y1) {
+		int n = dst_w * 4;
+		std::vector<float> acc (n);
+		std::vector<uint16_t> row (n);
+		for (int y = y0; y < y1; y++) {
+			const uint16_t *out = &inter[(size_t)y * n];
+			if (src_h != dst_h) {
+				std::fill (acc.begin (), acc.end (), 0.f);
+				const float *w = vtaps.weights_for (y);
+				int first = vtaps.start[y];
+				for (int k = 0; k < vtaps.count[y]; k++)
+					accumulate_row_v (acc.data (), &inter[(size_t)(first + k) * n], w[k], n);
+				store_row_v (acc.data (), row.data (), n);
+				out = row.data ();
+			}
+			from_linear_row (out, fmt, dst_w, premul, dst_bits + y * dst_bpl);
+		}
+	});
+	return dst;
+}
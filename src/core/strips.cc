@@ -0,0 +1,276 @@
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include <QFile>
+#include <QSaveFile>
+#include <QImageReader>
+#include <QImageIOHandler>
+
+#include "tweaks.h"
+#include "pipeline.h"
+#include "strips.h"
+
+QSize limited_size (QSize sz, qint64 pixels)
+{
+	qint64 have = (qint64)sz.width () * sz.height ();
+	if (have <= pixels)
+		return sz;
+	double f = sqrt ((double)pixels / have);
+	return QSize (std::max (1, (int)(sz.width () * f)), std::max (1, (int)(sz.height () * f)));
+}
+
+bool can_read_strips (QImageReader &reader)
+{
+	return reader.size ().isValid () && reader.supportsOption (QImageIOHandler::ClipRect);
+}
+
+namespace {
+
+/* Reads an image file in horizontal strips through the decoder's clip
+   rectangle, so that only one strip is ever held in memory.  Qt has no way to
+   continue decoding where the last strip ended: every strip starts from the
+   top of the file and decodes up to its last row, discarding the rows above.
+   The time therefore grows with the square of the height, the memory only
+   with the strip.  */
+class strip_source
+{
+	QFile m_file;
+	QByteArray m_format;
+	QSize m_size;
+	QString m_error;
+
+public:
+	strip_source (const QString &path, const QByteArray &format) : m_file (path), m_format (format)
+	{
+	}
+	bool open ();
+	QImage read (int y, int h);
+	QSize size () const { return m_size; }
+	const QString &error () const { return m_error; }
+};
+
+bool strip_source::open ()
+{
+	if (!m_file.open (QIODevice::ReadOnly)) {
+		m_error = m_file.errorString ();
+		return false;
+	}
+	QImageReader reader (&m_file, m_format);
+	m_size = reader.size ();
+	if (!can_read_strips (reader)) {
+		m_error = "the decoder cannot read this image in strips";
+		return false;
+	}
+	return true;
+}
+
+QImage strip_source::read (int y, int h)
+{
+	m_file.seek (0);
+	QImageReader reader (&m_file, m_format);
+	reader.setClipRect (QRect (0, y, m_size.width (), h));
+	QImage result = reader.read ();
+	if (result.isNull ())
+		m_error = reader.errorString ();
+	return result;
+}
+
+/* Writes an uncompressed RGB TIFF file with 16 bits per sample, one strip at
+   a time.  Since the strips are not compressed, all offsets are known before
+   the first pixel is written, and the file is produced front to back.  Files
+   too large for the 32 bit offsets of classic TIFF are written as BigTIFF.  */
+class tiff_writer
+{
+	QIODevice *m_dev;
+	QSize m_size;
+	int m_rows;
+	QByteArray m_buf;
+
+	struct field
+	{
+		uint16_t tag, type;
+		std::vector<uint64_t> values;
+	};
+	enum { SHORT = 3, LONG = 4, LONG8 = 16 };
+
+	static int type_size (int type)
+	{
+		return type == SHORT ? 2 : type == LONG ? 4 : 8;
+	}
+	static void put (QByteArray &b, uint64_t v, int bytes)
+	{
+		for (int i = 0; i < bytes; i++)
+			b.append ((char)(v >> (8 * i)));
+	}
+
+public:
+	tiff_writer (QIODevice *dev, QSize size, int rows_per_strip)
+		: m_dev (dev), m_size (size), m_rows (rows_per_strip)
+	{
+	}
+	bool write_header (int orientation);
+	bool write_strip (const QImage &);
+};
+
+bool tiff_writer::write_header (int orientation)
+{
+	uint64_t w = m_size.width ();
+	uint64_t h = m_size.height ();
+	uint64_t nstrips = (h + m_rows - 1) / m_rows;
+	uint64_t row_bytes = w * 6;
+	/* The header and tags are tiny compared to the data, 64K is plenty.  */
+	bool big = row_bytes * h + nstrips * 8 + 65536 > 0xffffffffu;
+	uint16_t off_type = big ? LONG8 : LONG;
+
+	std::vector<uint64_t> counts;
+	for (uint64_t y = 0; y < h; y += m_rows)
+		counts.push_back (row_bytes * std::min<uint64_t> (m_rows, h - y));
+
+	std::vector<field> fields = {
+		{ 256, LONG, { w } },
+		{ 257, LONG, { h } },
+		{ 258, SHORT, { 16, 16, 16 } },
+		{ 259, SHORT, { 1 } },		/* No compression.  */
+		{ 262, SHORT, { 2 } },		/* RGB.  */
+		{ 273, off_type, std::vector<uint64_t> (nstrips) },
+		{ 274, SHORT, { (uint64_t)orientation } },
+		{ 277, SHORT, { 3 } },
+		{ 278, LONG, { (uint64_t)m_rows } },
+		{ 279, off_type, counts },
+		{ 284, SHORT, { 1 } }		/* Interleaved samples.  */
+	};
+
+	int hdr_size = big ? 16 : 8;
+	int ifd_size = big ? 8 + fields.size () * 20 + 8 : 2 + fields.size () * 12 + 4;
+	int inline_max = big ? 8 : 4;
+	uint64_t ext_size = 0;
+	for (auto &f: fields) {
+		uint64_t sz = type_size (f.type) * f.values.size ();
+		if (sz > (uint64_t)inline_max)
+			ext_size += (sz + 1) & ~1;
+	}
+	uint64_t data_start = hdr_size + ifd_size + ext_size;
+	for (uint64_t i = 0; i < nstrips; i++)
+		fields[5].values[i] = data_start + i * m_rows * row_bytes;
+
+	QByteArray hdr;
+	hdr.append ("II", 2);
+	if (big) {
+		put (hdr, 43, 2);
+		put (hdr, 8, 2);
+		put (hdr, 0, 2);
+		put (hdr, hdr_size, 8);
+		put (hdr, fields.size (), 8);
+	} else {
+		put (hdr, 42, 2);
+		put (hdr, hdr_size, 4);
+		put (hdr, fields.size (), 2);
+	}
+	QByteArray ext;
+	uint64_t ext_pos = hdr_size + ifd_size;
+	for (auto &f: fields) {
+		int tsz = type_size (f.type);
+		uint64_t sz = tsz * f.values.size ();
+		put (hdr, f.tag, 2);
+		put (hdr, f.type, 2);
+		put (hdr, f.values.size (), big ? 8 : 4);
+		if (sz > (uint64_t)inline_max) {
+			put (hdr, ext_pos + ext.size (), inline_max);
+			for (auto v: f.values)
+				put (ext, v, tsz);
+			if (sz & 1)
+				ext.append ('\0');
+		} else {
+			for (auto v: f.values)
+				put (hdr, v, tsz);
+			put (hdr, 0, inline_max - sz);
+		}
+	}
+	put (hdr, 0, big ? 8 : 4);
+	hdr.append (ext);
+	return m_dev->write (hdr) == hdr.size ();
+}
+
+bool tiff_writer::write_strip (const QImage &strip)
+{
+	int w = m_size.width ();
+	m_buf.resize (w * 6);
+	for (int y = 0; y < strip.height (); y++) {
+		const uint16_t *src = (const uint16_t *)strip.constScanLine (y);
+		unsigned char *dst = (unsigned char *)m_buf.data ();
+		for (int x = 0; x < w; x++) {
+			for (int c = 0; c < 3; c++) {
+				uint16_t v = src[c];
+				*dst++ = v & 255;
+				*dst++ = v >> 8;
+			}
+			src += 4;
+		}
+		if (m_dev->write (m_buf) != m_buf.size ())
+			return false;
+	}
+	return true;
+}
+
+/* The TIFF orientation that displays the stored image the way rotate_image
+   would have transformed it: mirrored first, then rotated clockwise.  */
+int tiff_orientation (int rot, bool mirror)
+{
+	rot = ((rot % 360) + 360) % 360;
+	static const int plain[4] = { 1, 6, 3, 8 };
+	static const int mirrored[4] = { 2, 7, 4, 5 };
+	return (mirror ? mirrored : plain)[rot / 90];
+}
+
+}
+
+QString export_streaming (const QString &src_path, const QByteArray &src_format,
+			  const img_tweaks &tw, const QString &dst)
+{
+	strip_source src (src_path, src_format);
+	if (!src.open ())
+		return src.error ();
+
+	QSize sz = src.size ();
+	int rows = std::max<qint64> (1, strip_pixels / sz.width ());
+
+	/* The tweaks are scaled against the extremes of the whole image, so those
+	   are needed before the first strip can be written.  Measure every strip
+	   in a first pass, which gives exactly the statistics of a full render.  */
+	linear_stats st;
+	for (int y = 0; y < sz.height (); y += rows) {
+		QImage strip = src.read (y, std::min (rows, sz.height () - y));
+		if (strip.isNull ())
+			return src.error ();
+		merge_stats (st, measure_linear (linear_image (strip, tw.cspace_idx)));
+	}
+
+	QSaveFile f (dst);
+	if (!f.open (QIODevice::WriteOnly))
+		return f.errorString ();
+	tiff_writer writer (&f, sz, rows);
+	if (!writer.write_header (tiff_orientation (tw.rot, tw.mirrored))) {
+		f.cancelWriting ();
+		return f.errorString ();
+	}
+	for (int y = 0; y < sz.height (); y += rows) {
+		int h = std::min (rows, sz.height () - y);
+		QImage strip = src.read (y, h);
+		if (strip.isNull () || strip.height () != h) {
+			f.cancelWriting ();
+			return src.error ();
+		}
+		QImage result = apply_tweaks (linear_image (strip, tw.cspace_idx), tw, st);
+		if (result.format () != QImage::Format_RGBA64)
+			result = result.convertToFormat (QImage::Format_RGBA64);
+		if (!writer.write_strip (result)) {
+			f.cancelWriting ();
+			return f.errorString ();
+		}
+	}
+	if (!f.commit ())
+		return f.errorString ();
+	return QString ();
+}
@@ -0,0 +1,127 @@
+#include <QRegularExpression>
+
+#include "tweaks.h"
+
+QString img_tweaks::to_string () const
+{
+	QString str;
+	if (blacklevel != 0)
+		str += "bk:" + QString::number (blacklevel) + ";";
+	if (gamma != 0)
+		str += "g:" + QString::number (gamma) + ";";
+	if (white != Qt::white)
+		str += "wb:" + QString::number (white.red ()) + "," + QString::number (white.green ())+ "," + QString::number (white.blue ()) + ";";
+	if (sat != 0)
+		str += "s:" + QString::number (sat) + ";";
+	if (brightness != 0)
+		str += "br:" + QString::number (brightness) + ";";
+	if (rot != 0)
+		str += "rot:" + QString::number (rot) + ";";
+	if (mirrored != 0)
+		str += "mir;";
+	if (cspace_idx != 0)
+		str += "cs:" + QString::number (cspace_idx) + ";";
+	str += unknown_tags;
+	return str;
+}
+
+// Return true for obsolete forms that we should rewrite.
+bool img_tweaks::from_string (QString s)
+{
+	static QRegularExpression re1 ("(\\d+),(-?\\d+),(\\d+),(\\d+),(\\d+),(-?\\d+),(-?\\d+)");
+	static QRegularExpression re2 ("(\\d+),(-?\\d+),(\\d+),(\\d+),(\\d+),(-?\\d+)");
+	static QRegularExpression re3 ("(\\d+),(-?\\d+),(\\d+),(\\d+),(\\d+)");
+
+	auto result1 = re1.match (s);
+	if (result1.hasMatch ()) {
+		blacklevel = result1.captured (1).toInt ();
+		gamma = result1.captured (2).toInt ();
+		white.setRed (result1.captured (3).toInt ());
+		white.setGreen (result1.captured (4).toInt ());
+		white.setBlue (result1.captured (5).toInt ());
+		sat = result1.captured (6).toInt ();
+		brightness = result1.captured (7).toInt ();
+		unknown_tags = QString ();
+		return true;
+	}
+	auto result2 = re2.match (s);
+	if (result2.hasMatch ()) {
+		blacklevel = result2.captured (1).toInt ();
+		gamma = result2.captured (2).toInt ();
+		white.setRed (result2.captured (3).toInt ());
+		white.setGreen (result2.captured (4).toInt ());
+		white.setBlue (result2.captured (5).toInt ());
+		sat = result2.captured (6).toInt ();
+		unknown_tags = QString ();
+		return true;
+	}
+	auto result3 = re3.match (s);
+	if (result3.hasMatch ()) {
+		blacklevel = result3.captured (1).toInt ();
+		gamma = result3.captured (2).toInt ();
+		white.setRed (result3.captured (3).toInt ());
+		white.setGreen (result3.captured (4).toInt ());
+		white.setBlue (result3.captured (5).toInt ());
+		sat = 0;
+		unknown_tags = QString ();
+		return true;
+	}
+
+	static QRegularExpression re_b ("bk:(\\d+);");
+	static QRegularExpression re_wb ("wb:(\\d+),(\\d+),(\\d+);");
+	static QRegularExpression re_sat ("s:(-?\\d+);");
+	static QRegularExpression re_gamma ("g:(-?\\d+);");
+	static QRegularExpression re_brite ("br:(-?\\d+);");
+	static QRegularExpression re_rot ("rot:(\\d+);");
+	static QRegularExpression re_mir ("mir;");
+	static QRegularExpression re_cs ("cs:(\\d+);");
+	auto result_b = re_b.match (s);
+	auto result_wb = re_wb.match (s);
+	auto result_sat = re_sat.match (s);
+	auto result_gamma = re_gamma.match (s);
+	auto result_brite = re_brite.match (s);
+	auto result_rot = re_rot.match (s);
+	auto result_mir = re_mir.match (s);
+	auto result_cs = re_cs.match (s);
+	if (result_b.hasMatch ())
+		blacklevel = result_b.captured (1).toInt ();
+	if (result_sat.hasMatch ()
+	    /* Using a single letter "s:" was a poor choice, and then using "cs:" was also a
+	       poor choice.  */
+	    && !result_cs.hasMatch () || result_sat.capturedStart (1) != result_cs.capturedStart (1))
+	{
+		sat = result_sat.captured (1).toInt ();
+	}
+	if (result_gamma.hasMatch ())
+		gamma = result_gamma.captured (1).toInt ();
+	if (result_brite.hasMatch ())
+		brightness = result_brite.captured (1).toInt ();
+	if (result_rot.hasMatch ())
+		rot = result_rot.captured (1).toInt ();
+	mirrored = result_mir.hasMatch ();
+	if (result_wb.hasMatch ()) {
+		white.setRed (result_wb.captured (1).toInt ());
+		white.setGreen (result_wb.captured (2).toInt ());
+		white.setBlue (result_wb.captured (3).toInt ());
+	}
+	if (result_cs.hasMatch ())
+		cspace_idx = result_cs.captured (1).toInt ();
+	if (result_cs.hasMatch () && result_sat.hasMatch ()
+	    && result_sat.capturedStart (1) != result_cs.capturedStart (1) && sat == cspace_idx) {
+		printf ("oops\n");
+	}
+	s.replace (re_b, "");
+	s.replace (re_wb, "");
+	s.replace (re_sat, "");
+	s.replace (re_gamma, "");
+	s.replace (re_brite, "");
+	s.replace (re_rot, "");
+	s.replace (re_mir, "");
+	s.replace (re_cs, "");
+	unknown_tags = s;
+#if 0
+	if (!s.isEmpty ())
+		qDebug () << "unknown tags: " << s;
+#endif
+	return false;
+}
@@ -0,0 +1,411 @@
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include <QDir>
+#include <QFile>
+#include <QSet>
+#include <QImageReader>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+
+#ifdef Q_OS_UNIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#else
+#include <QDirIterator>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <QSocketNotifier>
+#else
+#include <QFileSystemWatcher>
+#endif
+
+#include "dirscan.h"
+
+static const QSet<QString> &image_suffixes ()
+{
+	static const QSet<QString> suffixes = [] ()
+	{
+		QSet<QString> s;
+		for (auto &f: QImageReader::supportedImageFormats ())
+			s.insert (QString::fromLatin1 (f).toLower ());
+		return s;
+	} ();
+	return suffixes;
+}
+
+bool is_image_name (const QDir &dir, const QString &name)
+{
+	if (name.startsWith ('.'))
+		return false;
+	int dot = name.lastIndexOf ('.');
+	if (dot > 0)
+		return image_suffixes ().contains (name.mid (dot + 1).toLower ());
+	/* No extension: look at the contents.  */
+	return !QImageReader::imageFormat (dir.filePath (name)).isEmpty ();
+}
+
+QString file_id (const QString &path)
+{
+#ifdef Q_OS_UNIX
+	struct stat st;
+	if (stat (QFile::encodeName (path).constData (), &st) == 0)
+		return file_id (st.st_dev, st.st_ino);
+#endif
+	return QFileInfo (path).absoluteFilePath ();
+}
+
+/* Call F (NAME, ISDIR, ID) for the subdirectories and regular files in PATH,
+   until it returns false.  "." and hidden entries are skipped, like QDir does,
+   but ".." is kept.  ID is empty where file_id would have to stat the file.  */
+static void list_directory (const QString &path,
+			    const std::function<bool (const QString &, bool, const QString &)> &f)
+{
+#ifdef Q_OS_UNIX
+	DIR *d = opendir (QFile::encodeName (path).constData ());
+	if (d == nullptr)
+		return;
+	int fd = dirfd (d);
+	struct stat dst;
+	quint64 dev = fstat (fd, &dst) == 0 ? dst.st_dev : 0;
+	for (;;) {
+		struct dirent *de = readdir (d);
+		if (de == nullptr)
+			break;
+		const char *n = de->d_name;
+		if (n[0] == '.' && strcmp (n, "..") != 0)
+			continue;
+		bool isdir;
+		QString id;
+		if (de->d_type == DT_DIR || de->d_type == DT_REG) {
+			isdir = de->d_type == DT_DIR;
+			id = file_id (dev, de->d_ino);
+		} else if (de->d_type == DT_LNK || de->d_type == DT_UNKNOWN) {
+			/* Only symlinks and file systems without d_type need a stat.  */
+			struct stat st;
+			if (fstatat (fd, n, &st, 0) != 0)
+				continue;
+			if (S_ISDIR (st.st_mode))
+				isdir = true;
+			else if (S_ISREG (st.st_mode))
+				isdir = false;
+			else
+				continue;
+			id = file_id (st.st_dev, st.st_ino);
+		} else
+			continue;
+		if (!f (QFile::decodeName (n), isdir, id))
+			break;
+	}
+	closedir (d);
+#else
+	QDirIterator it (path, QDir::Dirs | QDir::Files | QDir::NoDot);
+	while (it.hasNext ()) {
+		it.next ();
+		if (!f (it.fileName (), it.fileInfo ().isDir (), QString ()))
+			break;
+	}
+#endif
+}
+
+namespace {
+
+/* The state of a recursive scan.  Workers take directories from TODO and add
+   what they find to DIRS/FILES/IDS, which the scanning thread hands out in
+   batches.  */
+struct tree_walk
+{
+	const QString root;
+	const std::atomic<int> &wanted_gen;
+	const int gen;
+
+	QMutex mutex;
+	QWaitCondition cond;
+	/* Directories still to be read, relative to ROOT, and the number being read.  */
+	std::vector<QString> todo { QString () };
+	int busy = 0;
+	/* Directories we have already queued, by file_id, so that symlinks can't
+	   make us go around in circles.  */
+	QSet<QString> seen_dirs;
+	QStringList dirs, files, ids;
+
+	tree_walk (const QString &r, const std::atomic<int> &wanted, int g)
+		: root (r), wanted_gen (wanted), gen (g)
+	{
+	}
+	bool cancelled () const { return wanted_gen != gen; }
+	bool done () const { return cancelled () || (todo.empty () && busy == 0); }
+	void work ();
+};
+
+void tree_walk::work ()
+{
+	QMutexLocker lock (&mutex);
+	for (;;) {
+		while (todo.empty () && !done ())
+			cond.wait (&mutex);
+		if (done ())
+			break;
+		QString rel = todo.back ();
+		todo.pop_back ();
+		busy++;
+		lock.unlock ();
+
+		QStringList found_dirs, found_dir_ids, found_files, found_ids, up;
+		QString prefix = rel.isEmpty () ? QString () : rel + "/";
+		QDir dir (QDir (root).filePath (rel));
+		list_directory (dir.path (), [&] (const QString &name, bool isdir, const QString &id) -> bool
+		{
+			if (name == "..") {
+				/* Only the top level gets a way up.  */
+				if (rel.isEmpty ())
+					up.append (name);
+			} else if (isdir) {
+				found_dirs.append (prefix + name);
+				found_dir_ids.append (id.isEmpty () ? file_id (dir.filePath (name)) : id);
+			} else if (is_image_name (dir, name)) {
+				found_files.append (prefix + name);
+				found_ids.append (id);
+			}
+			return !cancelled ();
+		});
+
+		lock.relock ();
+		busy--;
+		dirs += up;
+		files += found_files;
+		ids += found_ids;
+		for (int i = 0; i < found_dirs.size (); i++)
+			if (!seen_dirs.contains (found_dir_ids[i])) {
+				seen_dirs.insert (found_dir_ids[i]);
+				todo.push_back (found_dirs[i]);
+			}
+		cond.wakeAll ();
+	}
+	cond.wakeAll ();
+}
+
+class walk_runner : public QRunnable
+{
+	tree_walk *m_walk;
+
+public:
+	walk_runner (tree_walk *w) : m_walk (w)
+	{
+		setAutoDelete (true);
+	}
+	void run () override
+	{
+		m_walk->work ();
+	}
+};
+
+}
+
+void DirScanner::slot_scan (int gen, QString path, bool recursive)
+{
+	QDir dir (path);
+	QStringList dirs, files, ids;
+	/* Start with small batches so that the first image arrives quickly, then
+	   grow them to keep the overhead down on huge directories.  */
+	int batch = 16;
+	QElapsedTimer timer;
+	timer.start ();
+	auto flush = [&] ()
+	{
+		emit signal_batch (gen, dirs, files, ids);
+		dirs.clear ();
+		files.clear ();
+		ids.clear ();
+		batch = std::min (batch * 2, 4096);
+		timer.restart ();
+	};
+
+	if (recursive) {
+		/* Reading directories is mostly waiting for the disk, so use more
+		   threads than there are cores, and keep them off the global pool
+		   that does the image processing.  */
+		tree_walk walk (path, wanted_gen, gen);
+		walk.seen_dirs.insert (file_id (path));
+		QThreadPool pool;
+		pool.setMaxThreadCount (std::max (8, QThread::idealThreadCount ()));
+		for (int i = 0; i < pool.maxThreadCount (); i++)
+			pool.start (new walk_runner (&walk));
+
+		QMutexLocker lock (&walk.mutex);
+		for (;;) {
+			bool done = walk.done ();
+			if (!done)
+				walk.cond.wait (&walk.mutex, 50);
+			if (walk.files.size () >= batch || timer.elapsed () > 50 || done) {
+				dirs += walk.dirs;
+				files += walk.files;
+				ids += walk.ids;
+				walk.dirs.clear ();
+				walk.files.clear ();
+				walk.ids.clear ();
+				lock.unlock ();
+				if (!dirs.isEmpty () || !files.isEmpty ())
+					flush ();
+				lock.relock ();
+			}
+			if (done)
+				break;
+		}
+		/* Workers may be waiting for more work after a cancellation.  */
+		walk.cond.wakeAll ();
+		lock.unlock ();
+		pool.waitForDone ();
+	} else
+		list_directory (path, [&] (const QString &name, bool isdir, const QString &id) -> bool
+		{
+			if (isdir)
+				dirs.append (name);
+			else if (is_image_name (dir, name)) {
+				files.append (name);
+				ids.append (id);
+			} else
+				return wanted_gen == gen;
+			if (dirs.size () + files.size () >= batch || timer.elapsed () > 50)
+				flush ();
+			return wanted_gen == gen;
+		});
+
+	if (wanted_gen != gen)
+		return;
+	if (!dirs.isEmpty () || !files.isEmpty ())
+		flush ();
+	emit signal_done (gen);
+}
+
+#ifdef Q_OS_LINUX
+
+DirWatcher::DirWatcher (QObject *parent)
+	: QObject (parent)
+{
+	m_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+	if (m_fd == -1)
+		return;
+	m_notifier = new QSocketNotifier (m_fd, QSocketNotifier::Read, this);
+	connect (m_notifier, &QSocketNotifier::activated, [this] () { read_events (); });
+}
+
+DirWatcher::~DirWatcher ()
+{
+	if (m_fd != -1)
+		close (m_fd);
+}
+
+void DirWatcher::watch (const QString &path)
+{
+	if (m_fd == -1)
+		return;
+	if (m_wd != -1)
+		inotify_rm_watch (m_fd, m_wd);
+	m_wd = -1;
+	m_path = path;
+	if (path.isEmpty ())
+		return;
+	m_wd = inotify_add_watch (m_fd, QFile::encodeName (path).constData (),
+				  IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR);
+}
+
+void DirWatcher::read_events ()
+{
+	alignas (struct inotify_event) char buf[16384];
+	/* A rename within the directory is a MOVED_FROM/MOVED_TO pair with the same
+	   cookie.  They arrive together, so pair them up within one read.  */
+	QHash<uint32_t, std::pair<QString, bool>> moved_from;
+	for (;;) {
+		ssize_t len = read (m_fd, buf, sizeof buf);
+		if (len <= 0)
+			break;
+		for (char *p = buf; p < buf + len; ) {
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+			p += sizeof (struct inotify_event) + ev->len;
+			if (ev->mask & IN_Q_OVERFLOW) {
+				emit signal_overflow ();
+				continue;
+			}
+			if (ev->wd != m_wd || ev->len == 0)
+				continue;
+			QString name = QFile::decodeName (ev->name);
+			bool isdir = (ev->mask & IN_ISDIR) != 0;
+			if (ev->mask & IN_MOVED_FROM)
+				moved_from.insert (ev->cookie, { name, isdir });
+			else if (ev->mask & IN_MOVED_TO) {
+				auto it = moved_from.find (ev->cookie);
+				if (it != moved_from.end ()) {
+					emit signal_renamed (it->first, name, isdir);
+					moved_from.erase (it);
+				} else
+					emit signal_created (name, isdir);
+			} else if (ev->mask & IN_CREATE)
+				emit signal_created (name, isdir);
+			else if (ev->mask & IN_DELETE)
+				emit signal_removed (name, isdir);
+			else if (ev->mask & IN_CLOSE_WRITE)
+				emit signal_modified (name);
+		}
+	}
+	/* Moved out of the directory.  */
+	for (auto &it: moved_from)
+		emit signal_removed (it.first, it.second);
+}
+
+#else
+
+DirWatcher::DirWatcher (QObject *parent)
+	: QObject (parent), m_fswatcher (new QFileSystemWatcher (this))
+{
+	connect (m_fswatcher, &QFileSystemWatcher::directoryChanged, [this] (const QString &) { dir_changed (); });
+}
+
+DirWatcher::~DirWatcher ()
+{
+}
+
+QHash<QString, bool> DirWatcher::list_dir () const
+{
+	QHash<QString, bool> result;
+	for (auto &fi: QDir (m_path).entryInfoList (QDir::Dirs | QDir::Files | QDir::NoDot))
+		result.insert (fi.fileName (), fi.isDir ());
+	return result;
+}
+
+void DirWatcher::watch (const QString &path)
+{
+	if (!m_path.isEmpty ())
+		m_fswatcher->removePath (m_path);
+	m_path = path;
+	m_known.clear ();
+	if (path.isEmpty ())
+		return;
+	m_fswatcher->addPath (path);
+	m_known = list_dir ();
+}
+
+void DirWatcher::dir_changed ()
+{
+	QHash<QString, bool> now = list_dir ();
+	for (auto it = m_known.cbegin (); it != m_known.cend (); ++it)
+		if (!now.contains (it.key ()))
+			emit signal_removed (it.key (), it.value ());
+	for (auto it = now.cbegin (); it != now.cend (); ++it)
+		if (!m_known.contains (it.key ()))
+			emit signal_created (it.key (), it.value ());
+	m_known = now;
+}
+
+#endif
@@ -1,40 +1,11 @@
-TEMPLATE	      = app
-CONFIG		     += qt warn_on force_debug_info thread c++17
-FORMS		      = mainwindow.ui prefsdialog.ui renamedialog.ui
+TEMPLATE	      = subdirs
 
-HEADERS		      = include/colors.h \
-                        include/mainwindow.h \
-                        include/prefsdlg.h \
-                        include/renamedlg.h \
-                        include/util-widgets.h
+# The image pipeline as a library without GUI, the viewer, and a headless
+# benchmark of the pipeline.
+SUBDIRS		      = core app bench
 
-SOURCES		      = main.cc util-widgets.cc \
-                        prefsdlg.cc renamedlg.cc renderer.cc tables.cc
-
-isEmpty(PREFIX) {
-PREFIX = /usr/local
-}
-
-TARGET                = equiv
-DATADIR               = $$PREFIX/share/equiv
-DOCDIR                = $$PREFIX/share/doc/equiv
-
-*-g++ {
-QMAKE_CXXFLAGS += -fno-diagnostics-show-caret
-}
-
-unix:INCLUDEPATH      += include
-win32:INCLUDEPATH     += include
-
-!win32:DEFINES       += "DATADIR=\\\"$$DATADIR\\\""
-!win32:DEFINES       += "DOCDIR=\\\"$$DOCDIR\\\""
-release:DEFINES      += NO_CHECK
-win32:DEFINES        += QT_DLL QT_THREAD_SUPPORT HAVE_CONFIG_H _USE_MATH_DEFINES
-
-target.path           = $$PREFIX/bin
-INSTALLS += target
-
-QT += widgets gui sql
-
-RESOURCES += \
-    equiv.qrc
+core.file	      = core/core.pro
+app.file	      = app.pro
+app.depends	      = core
+bench.file	      = bench/bench.pro
+bench.depends	      = core
@@ -0,0 +1,311 @@
+#include <cstdio>
+#include <atomic>
+#include <algorithm>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDirIterator>
+#include <QSaveFile>
+#include <QImage>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QCryptographicHash>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+
+#include "equiv.h"
+#include "tweaks.h"
+#include "decode.h"
+#include "dirscan.h"
+#include "pipeline.h"
+#include "strips.h"
+#include "export.h"
+
+QString export_image (const QImage &src, const img_tweaks &tw, const QString &path,
+		      const QByteArray &format, int quality)
+{
+	QImage result = render_full (src, tw);
+	if (format != "tiff")
+		result = result.convertToFormat (format == "jpeg" ? QImage::Format_RGB32 : QImage::Format_ARGB32);
+
+	/* Write to a temporary file, so that an interrupted export never leaves a
+	   truncated image behind.  */
+	QSaveFile f (path);
+	if (!f.open (QIODevice::WriteOnly))
+		return f.errorString ();
+	QImageWriter writer (&f, format);
+	if (format == "jpeg")
+		writer.setQuality (quality);
+	if (!writer.write (result)) {
+		f.cancelWriting ();
+		return writer.errorString ();
+	}
+	if (!f.commit ())
+		return f.errorString ();
+	return QString ();
+}
+
+QString export_file (const QString &src, const img_tweaks &tw, const QString &path,
+		     const QByteArray &format, int quality, QString *warning)
+{
+	QByteArray src_format = QFileInfo (src).suffix ().toLatin1 ();
+	QImageReader reader (src, src_format);
+	QSize full_size = reader.size ();
+	bool large = is_large_image (full_size);
+#if QT_VERSION >= QT_VERSION_CHECK (6, 0, 0)
+	/* Qt refuses to decode large images by default.  The limit is process
+	   wide, and lifted for both paths below.  */
+	if (large)
+		QImageReader::setAllocationLimit (0);
+#endif
+	if (large && format == "tiff" && can_read_strips (reader))
+		return export_streaming (src, src_format, tw, path);
+	/* Anything else needs the whole image in memory.  Try that, and if it
+	   cannot be decoded in full, export it at the size the viewer uses.  */
+	QImage img = reader.read ();
+	QString err = reader.errorString ();
+	if (img.isNull () && large) {
+		QImageReader scaled_reader (src, src_format);
+		QSize sz = limited_size (full_size, large_image_pixels);
+		scaled_reader.setScaledSize (sz);
+		img = scaled_reader.read ();
+		err = scaled_reader.errorString ();
+		if (!img.isNull () && warning != nullptr)
+			*warning = QObject::tr ("too large to decode, exported at %1x%2 instead of %3x%4, use TIFF for the full size")
+				.arg (sz.width ()).arg (sz.height ()).arg (full_size.width ()).arg (full_size.height ());
+	}
+	if (img.isNull ())
+		return err;
+	return export_image (img, tw, path, format, quality);
+}
+
+namespace {
+
+struct export_job
+{
+	QString src;
+	QString dst;
+};
+
+/* Roughly the most memory exporting SRC to FORMAT takes at any one time.  */
+qint64 export_memory (const QString &src, const QByteArray &format)
+{
+	QImageReader reader (src, QFileInfo (src).suffix ().toLatin1 ());
+	QSize sz = reader.size ();
+	qint64 pixels = sz.isValid () ? (qint64)sz.width () * sz.height () : large_image_pixels;
+	if (is_large_image (sz) && format == "tiff" && can_read_strips (reader))
+		pixels = std::min (pixels, strip_pixels);
+	return pixels * pipeline_bytes_per_pixel;
+}
+
+/* The memory the workers may use between them.  A worker waits until the
+   memory for its image is free; an image that needs more than all of it
+   waits for all of it, and so is exported alone.  */
+class memory_budget
+{
+	QMutex m_mutex;
+	QWaitCondition m_cond;
+	qint64 m_total;
+	qint64 m_free;
+
+public:
+	memory_budget (qint64 total) : m_total (total), m_free (total)
+	{
+	}
+	/* Returns what was taken, to be passed to release.  */
+	qint64 acquire (qint64 bytes)
+	{
+		bytes = std::min (bytes, m_total);
+		QMutexLocker lock (&m_mutex);
+		while (m_free < bytes)
+			m_cond.wait (&m_mutex);
+		m_free -= bytes;
+		return bytes;
+	}
+	void release (qint64 bytes)
+	{
+		QMutexLocker lock (&m_mutex);
+		m_free += bytes;
+		m_cond.wakeAll ();
+	}
+};
+
+/* State shared by the workers.  The tweaks table is only read once the
+   workers are running.  */
+struct export_state
+{
+	const export_options &opts;
+	QHash<QString, QString> tweaks;
+	std::atomic<int> done { 0 };
+	std::atomic<int> failed { 0 };
+	int total = 0;
+	QMutex output_mutex;
+	memory_budget memory;
+
+	export_state (const export_options &o) : opts (o), memory (o.memory)
+	{
+	}
+	void report (const QString &msg)
+	{
+		QMutexLocker lock (&output_mutex);
+		fprintf (stderr, "%s\n", msg.toLocal8Bit ().constData ());
+	}
+	void run (const export_job &);
+};
+
+void export_state::run (const export_job &job)
+{
+	QFile f (job.src);
+	if (!f.open (QIODevice::ReadOnly)) {
+		failed++;
+		report (QString ("%1: %2").arg (job.src, f.errorString ()));
+		return;
+	}
+	QCryptographicHash md5 (QCryptographicHash::Md5);
+	md5.addData (&f);
+	f.close ();
+	QString hash = encode_hash (md5.result ());
+
+	img_tweaks tw;
+	auto it = tweaks.constFind (hash);
+	if (it != tweaks.cend ())
+		tw.from_string (*it);
+
+	QDir ().mkpath (QFileInfo (job.dst).path ());
+	QString warning;
+	qint64 mem = memory.acquire (export_memory (job.src, opts.format));
+	QString err = export_file (job.src, tw, job.dst, opts.format, opts.quality, &warning);
+	memory.release (mem);
+	if (!err.isEmpty ()) {
+		failed++;
+		report (QString ("%1: %2").arg (job.src, err));
+		return;
+	}
+	if (!warning.isEmpty ())
+		report (QString ("%1: warning: %2").arg (job.src, warning));
+	int n = ++done;
+	report (QString ("[%1/%2] %3").arg (n).arg (total).arg (job.dst));
+}
+
+class export_runner : public QRunnable
+{
+	export_state *m_state;
+	export_job m_job;
+
+public:
+	export_runner (export_state *s, export_job j) : m_state (s), m_job (std::move (j))
+	{
+		setAutoDelete (true);
+	}
+	void run () override
+	{
+		m_state->run (m_job);
+	}
+};
+
+}
+
+int run_export (const QStringList &inputs, const export_options &opts)
+{
+	QByteArray suffix = opts.format == "jpeg" ? "jpg" : opts.format == "tiff" ? "tif" : opts.format;
+	if (!QImageWriter::supportedImageFormats ().contains (opts.format)) {
+		fprintf (stderr, "error: unsupported output format %s\n", opts.format.constData ());
+		return 1;
+	}
+	QDir outdir (opts.outdir);
+	if (!outdir.mkpath (".")) {
+		fprintf (stderr, "error: cannot create %s\n", opts.outdir.toLocal8Bit ().constData ());
+		return 1;
+	}
+
+	/* Outputs are named after the input, relative to the directory given on the
+	   command line, with the suffix of the output format.  */
+	struct input_file
+	{
+		QString path;
+		QString rel;
+	};
+	std::vector<input_file> found;
+	QSet<QString> seen;
+	auto add = [&] (const QString &path, const QString &rel)
+	{
+		/* A file given twice is exported once.  */
+		QString abs = QFileInfo (path).absoluteFilePath ();
+		if (seen.contains (abs))
+			return;
+		seen.insert (abs);
+		found.push_back ({ path, rel });
+	};
+	for (auto &in: inputs) {
+		QFileInfo fi (in);
+		if (!fi.isDir ()) {
+			add (in, fi.fileName ());
+			continue;
+		}
+		QDir dir (in);
+		QDirIterator it (in, QDir::Files,
+				 opts.recursive ? QDirIterator::Subdirectories : QDirIterator::NoIteratorFlags);
+		while (it.hasNext ()) {
+			it.next ();
+			if (is_image_name (it.fileInfo ().dir (), it.fileName ()))
+				add (it.filePath (), dir.relativeFilePath (it.filePath ()));
+		}
+	}
+
+	/* Inputs that would get the same name, such as a.jpg and a.png, keep their
+	   own suffix as well: a.jpg.tif and a.png.tif.  Workers must never write
+	   the same file, so anything still clashing after that is an error.  */
+	auto out_path = [&] (const QString &rel, bool keep_suffix)
+	{
+		QFileInfo fi (rel);
+		QString name = (keep_suffix ? fi.fileName () : fi.completeBaseName ()) + "." + QString::fromLatin1 (suffix);
+		return outdir.filePath (fi.path () == "." ? name : fi.path () + "/" + name);
+	};
+	QHash<QString, int> uses;
+	for (auto &f: found)
+		uses[out_path (f.rel, false)]++;
+	std::vector<export_job> jobs;
+	QHash<QString, QString> taken;
+	for (auto &f: found) {
+		QString dst = out_path (f.rel, false);
+		if (uses[dst] > 1)
+			dst = out_path (f.rel, true);
+		auto it = taken.constFind (dst);
+		if (it != taken.cend ()) {
+			fprintf (stderr, "error: %s and %s would both be exported to %s\n",
+				 it->toLocal8Bit ().constData (), f.path.toLocal8Bit ().constData (),
+				 dst.toLocal8Bit ().constData ());
+			return 1;
+		}
+		taken.insert (dst, f.path);
+		jobs.push_back ({ f.path, dst });
+	}
+
+	export_state state (opts);
+	state.total = jobs.size ();
+
+	/* Read all stored tweaks up front, so that the workers need no database.  */
+	QSqlQuery q (QSqlDatabase::database (PACKAGE));
+	if (q.exec ("select md5, tweaks from img_tweaks"))
+		while (q.next ())
+			state.tweaks.insert (q.value (0).toString (), q.value (1).toString ());
+
+	/* One image per worker, and only as many at a time as the memory budget
+	   allows; the work within an image still goes to the global pool.  */
+	QThreadPool pool;
+	pool.setMaxThreadCount (opts.jobs > 0 ? opts.jobs : QThread::idealThreadCount ());
+	for (auto &j: jobs)
+		pool.start (new export_runner (&state, std::move (j)));
+	pool.waitForDone ();
+
+	fprintf (stderr, "%d of %d images exported, %d failed\n", state.done.load (), state.total, state.failed.load ());
+	return state.failed > 0 ? 1 : 0;
+}
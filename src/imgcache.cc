@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <unordered_set>
+
+#include <QFileInfo>
+
+#include "imgentry.h"
+#include "imgcache.h"
+#include "dirscan.h"
+
+QString image_cache::known_hash (const QFileInfo &info, const QString &id) const
+{
+	auto it = m_files.constFind (id.isEmpty () ? file_id (info.absoluteFilePath ()) : id);
+	if (it == m_files.cend () || it->mtime != info.lastModified () || it->size != info.size ())
+		return QString ();
+	return it->hash;
+}
+
+void image_cache::remember_file (const QFileInfo &info, const QString &id, const QString &hash)
+{
+	m_files.insert (id.isEmpty () ? file_id (info.absoluteFilePath ()) : id,
+			{ info.lastModified (), info.size (), hash });
+}
+
+std::shared_ptr<img> image_cache::find (const QString &hash)
+{
+	auto it = m_by_hash.find (hash);
+	if (it == m_by_hash.end ()) {
+		m_misses++;
+		return nullptr;
+	}
+	m_hits++;
+	m_lru.splice (m_lru.begin (), m_lru, it->lru);
+	return it->images;
+}
+
+void image_cache::insert (const QString &hash, std::shared_ptr<img> images)
+{
+	auto it = m_by_hash.find (hash);
+	if (it != m_by_hash.end ()) {
+		it->images = std::move (images);
+		m_lru.splice (m_lru.begin (), m_lru, it->lru);
+		return;
+	}
+	m_lru.push_front (hash);
+	m_by_hash.insert (hash, { std::move (images), m_lru.begin () });
+}
+
+/* Replace the render set by F applied to a copy of it.  Both the renderer and
+   the GUI change the set, so retry if the other got there first.  */
+template<class F>
+void img::update_renders (F f)
+{
+	std::shared_ptr<const render_set> old = renders ();
+	for (;;) {
+		auto next = std::make_shared<render_set> (*old);
+		f (*next);
+		std::shared_ptr<const render_set> next_c = std::move (next);
+		if (std::atomic_compare_exchange_weak (&m_renders, &old, next_c))
+			return;
+	}
+}
+
+std::shared_ptr<const render_result> img::find_render (const img_tweaks &tw, bool do_scale, QSize size) const
+{
+	for (auto &r: *renders ())
+		if (r->matches (tw, do_scale, size))
+			return r;
+	return nullptr;
+}
+
+void img::publish (std::shared_ptr<const render_result> r)
+{
+	if (rendered () == r)
+		return;
+	update_renders ([&] (render_set &set) {
+		auto it = std::find (set.begin (), set.end (), r);
+		if (it != set.end ())
+			set.erase (it);
+		set.insert (set.begin (), r);
+		if (set.size () > max_renders)
+			set.resize (max_renders);
+	});
+}
+
+void img::replace_render (const std::shared_ptr<const render_result> &old, std::shared_ptr<const render_result> r)
+{
+	update_renders ([&] (render_set &set) {
+		auto it = std::find (set.begin (), set.end (), old);
+		if (it != set.end ())
+			*it = r;
+	});
+}
+
+void img::drop_old_renders ()
+{
+	if (renders ()->size () > 1)
+		update_renders ([] (render_set &set) {
+			if (set.size () > 1)
+				set.resize (1);
+		});
+}
+
+static qint64 pixmap_bytes (const QPixmap &pm)
+{
+	return (qint64)pm.width () * pm.height () * pm.depth () / 8;
+}
+
+/* Renders of one image share buffers, so count each buffer once.  */
+static qint64 renders_bytes (const render_set &set)
+{
+	std::unordered_set<qint64> pixmaps, images;
+	std::unordered_set<const void *> linear;
+	qint64 total = 0;
+	for (auto &r: set) {
+		if (!r->linear.is_null () && linear.insert (r->linear.row (0, 0)).second)
+			total += r->linear.size_in_bytes ();
+		if (!r->corrected_src.isNull () && images.insert (r->corrected_src.cacheKey ()).second)
+			total += r->corrected_src.sizeInBytes ();
+		for (const QPixmap *pm: { &r->corrected, &r->scaled })
+			if (!pm->isNull () && pixmaps.insert (pm->cacheKey ()).second)
+				total += pixmap_bytes (*pm);
+	}
+	return total;
+}
+
+static qint64 img_bytes (const img &i)
+{
+	return pixmap_bytes (i.on_disk) + renders_bytes (*i.renders ());
+}
+
+qint64 image_cache::bytes () const
+{
+	qint64 total = 0;
+	for (auto &c: m_by_hash)
+		total += img_bytes (*c.images);
+	return total;
+}
+
+void image_cache::prune (qint64 budget)
+{
+	qint64 total = bytes ();
+
+	/* Older renders go first, least recently used images first; they only
+	   save rendering again.  */
+	for (auto it = m_lru.end (); total > budget && it != m_lru.begin ();) {
+		--it;
+		img &i = *m_by_hash.find (*it)->images;
+		qint64 before = img_bytes (i);
+		i.drop_old_renders ();
+		total -= before - img_bytes (i);
+	}
+
+	auto it = m_lru.end ();
+	while (total > budget && it != m_lru.begin ()) {
+		--it;
+		auto c = m_by_hash.find (*it);
+		/* Images still referenced by the model stay; the model's own LRU
+		   decides when to let go of them.  */
+		if (c->images.use_count () > 1)
+			continue;
+		total -= img_bytes (*c->images);
+		m_by_hash.erase (c);
+		it = m_lru.erase (it);
+	}
+}
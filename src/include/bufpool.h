@@ -0,0 +1,66 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include <QImage>
+
+/* A pool of large pixel buffers.  Every render needs several buffers the size
+   of the image, and getting them from malloc means mmap, munmap and faulting
+   every page in again, each time.  Freed buffers are kept instead, in size
+   classes so that a buffer can be reused for a slightly smaller image.  Large
+   buffers are aligned to 2 MB and, where the system supports it, backed by
+   huge pages.  All functions are thread safe.  */
+
+/* Return a buffer of at least BYTES bytes, aligned to at least 64, or null if
+   there is no memory.  It must be freed with pool_free and the same size.  */
+extern void *pool_alloc (size_t bytes);
+extern void pool_free (void *p, size_t bytes);
+
+/* Give all unused buffers back to the system.  */
+extern void pool_trim ();
+/* Set the largest number of bytes kept in unused buffers.  */
+extern void pool_set_limit (size_t bytes);
+
+struct pool_stats
+{
+	/* Allocations served from the pool, and from the system.  */
+	qint64 hits = 0, misses = 0;
+	qint64 bytes_used = 0, bytes_free = 0;
+};
+extern pool_stats buffer_pool_stats ();
+
+/* A QImage of SZ and FMT whose pixels come from the pool, and go back to it
+   when the last copy of the image is destroyed.  Null if there is no
+   memory.  */
+extern QImage pooled_image (QSize sz, QImage::Format fmt);
+
+/* N elements of T from the pool, for temporary use in a scope.  The
+   elements are not initialized.  */
+template<class T>
+class pool_array
+{
+	T *m_data;
+	size_t m_bytes;
+
+public:
+	explicit pool_array (size_t n) : m_bytes (n * sizeof (T))
+	{
+		m_data = (T *)pool_alloc (m_bytes);
+		if (m_data == nullptr)
+			throw std::bad_alloc ();
+	}
+	~pool_array ()
+	{
+		pool_free (m_data, m_bytes);
+	}
+	pool_array (const pool_array &) = delete;
+	pool_array &operator= (const pool_array &) = delete;
+
+	T *data () { return m_data; }
+	T &operator[] (size_t i) { return m_data[i]; }
+};
+
+#endif
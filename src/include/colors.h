@@ -5,6 +5,97 @@
 #include <cstdint>
 #include <cmath>
 
+/* Compile time versions of exp, log and pow, only good enough to build the
+   tables below.  The standard ones are not constexpr before C++26.  */
+constexpr double cx_ln2 = 0.693147180559945309417;
+
+constexpr double cx_exp (double x)
+{
+	/* exp (x) = 2^k exp (r) with |r| <= ln 2 / 2, and a Taylor series for exp (r).  */
+	int k = (int)(x / cx_ln2 + (x < 0 ? -0.5 : 0.5));
+	double r = x - k * cx_ln2;
+	double term = 1, sum = 1;
+	for (int i = 1; i < 20; i++) {
+		term *= r / i;
+		sum += term;
+	}
+	for (; k > 0; k--)
+		sum *= 2;
+	for (; k < 0; k++)
+		sum /= 2;
+	return sum;
+}
+
+constexpr double cx_log (double x)
+{
+	int k = 0;
+	for (; x > 1.5; k++)
+		x /= 2;
+	for (; x < 0.75; k--)
+		x *= 2;
+	/* log (x) = 2 atanh ((x - 1) / (x + 1)), and the argument is at most 0.2.  */
+	double z = (x - 1) / (x + 1);
+	double term = z, sum = 0;
+	for (int i = 1; i < 40; i += 2) {
+		sum += term / i;
+		term *= z * z;
+	}
+	return 2 * sum + k * cx_ln2;
+}
+
+constexpr double cx_pow (double x, double y)
+{
+	return x <= 0 ? 0 : cx_exp (y * cx_log (x));
+}
+
+/* The sRGB transfer function, for values between 0 and 1.  */
+constexpr double srgb_decode (double s)
+{
+	constexpr double a = 0.055;
+	return s < 0.04045 ? s / 12.92 : cx_pow ((s + a) / (1 + a), 2.4);
+}
+
+struct srgb_tables
+{
+	/* 8 bit sRGB to linear, as a double between 0 and 1 and in 16 bits.  */
+	double to_linear[256] {};
+	uint16_t to_linear16[256] {};
+	/* 16 bit linear to the nearest 8 bit sRGB value.  */
+	uint8_t to_srgb8[65536] {};
+};
+
+constexpr srgb_tables make_srgb_tables ()
+{
+	srgb_tables t;
+	for (int v = 0; v < 256; v++) {
+		t.to_linear[v] = srgb_decode (v / 255.);
+		t.to_linear16[v] = t.to_linear[v] * 65535 + 0.5;
+	}
+	/* Rather than encoding every entry, find the linear values where the
+	   rounded sRGB value steps up: encoding rounds to C exactly for linear
+	   values below the decoded midpoint between C and C + 1.  */
+	int c = 0;
+	double next = srgb_decode (0.5 / 255) * 65535;
+	for (int i = 0; i < 65536; i++) {
+		while (c < 255 && i >= next) {
+			c++;
+			next = c < 255 ? srgb_decode ((c + 0.5) / 255) * 65535 : 65536;
+		}
+		t.to_srgb8[i] = c;
+	}
+	return t;
+}
+
+/* Built by the compiler; 66 KB, of which the decoding half fits in L1.  */
+inline constexpr srgb_tables srgb_table = make_srgb_tables ();
+
+static_assert (srgb_table.to_linear16[0] == 0 && srgb_table.to_linear16[255] == 65535);
+static_assert (srgb_table.to_srgb8[0] == 0 && srgb_table.to_srgb8[65535] == 255);
+static_assert (srgb_table.to_srgb8[srgb_table.to_linear16[128]] == 128);
+
+/* The single colour versions below are for the user interface.  They work
+   in doubles and floor the result, as they always have, so that colours
+   picked for existing edits do not change; pixel loops use the tables.  */
 static inline double srgb_to_linear (int v)
 {
 	double s = v / 255.;
@@ -23,6 +114,31 @@ static inline int linear_to_srgb (double v)
 	return floor (nv * 255);
 }
 
+/* Decode N pixels of 8 bit sRGB to linear in the channel order of
+   Format_RGBA64, four values per pixel.  Alpha is only widened.  */
+static inline void srgb8_to_linear16 (const QRgb *src, uint16_t *dst, int n)
+{
+	const uint16_t *lut = srgb_table.to_linear16;
+	for (int i = 0; i < n; i++) {
+		QRgb c = src[i];
+		dst[0] = lut[qRed (c)];
+		dst[1] = lut[qGreen (c)];
+		dst[2] = lut[qBlue (c)];
+		dst[3] = qAlpha (c) * 257;
+		dst += 4;
+	}
+}
+
+/* The inverse: encode N pixels of linear Format_RGBA64 data to 8 bit sRGB.  */
+static inline void linear16_to_srgb8 (const uint16_t *src, QRgb *dst, int n)
+{
+	const uint8_t *lut = srgb_table.to_srgb8;
+	for (int i = 0; i < n; i++) {
+		dst[i] = qRgba (lut[src[0]], lut[src[1]], lut[src[2]], (src[3] + 128) / 257);
+		src += 4;
+	}
+}
+
 static inline QColor srgb_to_linear (QColor corig)
 {
 	return QColor (255 * srgb_to_linear (corig.red ()),
@@ -0,0 +1,18 @@
+#ifndef COLORXFORM_H
+#define COLORXFORM_H
+
+#include <QImage>
+#include <QColorSpace>
+
+/* Convert IMG, which must be in Format_RGBA64, in place from its colour space
+   to DST.  Equivalent to QImage::convertToColorSpace, but the transforms are
+   cached, so that images that share a colour space pay no setup cost.
+
+   Between colour spaces that differ only in their transfer function, such as
+   sRGB and linear sRGB, the transform should work on each channel separately.
+   It is then done through a table with one entry per 16 bit value, computed
+   by Qt's own transform.  The table is only used if it also gives Qt's results
+   for a grid of coloured pixels; equiv-bench --verify checks random ones.  */
+extern void convert_color_space (QImage &img, const QColorSpace &dst);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <QImage>
+#include <QString>
+#include <QByteArray>
+
+class QIODevice;
+
+/* The form of an MD5 digest that identifies images, in the cache as well as
+   in the database.  */
+extern QString encode_hash (const QByteArray &md5);
+/* The encoded MD5 of the contents of the file at PATH, or an empty string if
+   it cannot be read.  */
+extern QString hash_file (const QString &path);
+
+struct decoded_image
+{
+	QImage image;
+	/* The size of the image in the file, which differs from the size of IMAGE
+	   if it was decoded at a reduced size.  */
+	QSize full_size;
+	/* Set if the image was reduced because it is too large to be decoded in
+	   full, see large_image_pixels.  */
+	bool oversized = false;
+	QString error;
+};
+
+/* Decode an image so that neither side is longer than MAX_DIM, if that is
+   nonzero.  Formats like JPEG can do this much faster than a full decode.
+   FORMAT may be empty to let Qt guess.  */
+extern decoded_image decode_image (QIODevice *dev, const QByteArray &format, int max_dim = 0);
+extern decoded_image decode_image (const QString &path, int max_dim = 0);
+
+/* Compute the average brightness along the edges of SRC, used for the background.  */
+extern void border_averages (const QImage &src, double &avgh, double &avgv);
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef DIRSCAN_H
+#define DIRSCAN_H
+
+#include <atomic>
+
+#include <QObject>
+#include <QStringList>
+#include <QHash>
+
+class QDir;
+class QSocketNotifier;
+class QFileSystemWatcher;
+
+/* A string that identifies a file rather than a name for it: hard links to
+   the same file get the same id.  Where the system has no such notion, this is
+   the absolute path.  */
+extern QString file_id (const QString &path);
+static inline QString file_id (quint64 dev, quint64 ino)
+{
+	return QString ("%1:%2").arg (dev).arg (ino);
+}
+
+/* True if NAME in DIR is a file we want to show: not hidden, and an image type
+   judging by its extension, or by its contents if it has none.  */
+extern bool is_image_name (const QDir &dir, const QString &name);
+
+/* Enumerates a directory on its own thread and delivers the entries in
+   batches, so that the first images can be shown before the whole directory
+   has been read.  Entries are not stat'ed unless the file system does not tell
+   us their type; files are filtered by their extension, or by their contents if
+   they have none.  The order of the entries is that of the file system.
+
+   A recursive scan reads the whole subtree with a pool of threads and delivers
+   the files under it with their paths relative to the top.  The only
+   directory it reports is the top level's "..".
+
+   Every file comes with its file_id, or an empty string if that can't be had
+   without a stat.  Hard links are found by comparing these.  */
+class DirScanner : public QObject
+{
+	Q_OBJECT
+
+public:
+	/* The generation of the most recently requested scan.  A running scan stops
+	   as soon as it notices it is no longer wanted.  */
+	std::atomic<int> wanted_gen { -1 };
+
+	void slot_scan (int gen, QString path, bool recursive);
+
+signals:
+	void signal_batch (int gen, QStringList dirs, QStringList files, QStringList ids);
+	void signal_done (int gen);
+};
+
+/* Watches one directory and reports changes to its entries, so that the model
+   can be edited in place instead of rescanning.  On Linux this uses inotify.
+   Elsewhere it falls back to QFileSystemWatcher and compares listings, which
+   cannot notice modified files.  */
+class DirWatcher : public QObject
+{
+	Q_OBJECT
+
+	QString m_path;
+#ifdef Q_OS_LINUX
+	int m_fd = -1;
+	int m_wd = -1;
+	QSocketNotifier *m_notifier {};
+
+	void read_events ();
+#else
+	QFileSystemWatcher *m_fswatcher {};
+	QHash<QString, bool> m_known;
+
+	QHash<QString, bool> list_dir () const;
+	void dir_changed ();
+#endif
+
+public:
+	DirWatcher (QObject *parent = nullptr);
+	~DirWatcher ();
+
+	/* Watch PATH instead of the previous directory.  An empty PATH stops watching.  */
+	void watch (const QString &path);
+
+signals:
+	void signal_created (QString name, bool isdir);
+	void signal_removed (QString name, bool isdir);
+	void signal_renamed (QString from, QString to, bool isdir);
+	void signal_modified (QString name);
+	/* Events were lost; the directory should be scanned again.  */
+	void signal_overflow ();
+};
+
+#endif
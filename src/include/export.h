@@ -0,0 +1,41 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+
+class QImage;
+struct img_tweaks;
+
+struct export_options
+{
+	QString outdir;
+	/* "png", "jpeg" or "tiff".  TIFF files are written with 16 bits per channel.  */
+	QByteArray format = "png";
+	int quality = 92;
+	/* Number of images processed at the same time, 0 for one per core.  */
+	int jobs = 0;
+	/* Bytes the images processed at the same time may use between them.
+	   Fewer than JOBS images run at once if they would need more.  */
+	qint64 memory = (qint64)4096 * 1024 * 1024;
+	bool recursive = false;
+};
+
+/* Apply TW to SRC and write the result to PATH in FORMAT.  Returns an error
+   message, or an empty string on success.  */
+extern QString export_image (const QImage &src, const img_tweaks &tw, const QString &path,
+			     const QByteArray &format, int quality);
+
+/* Read the image file SRC and export it like export_image.  Images too large
+   to be held in memory are streamed to TIFF if the decoder can read them in
+   strips.  Otherwise they are decoded in full if possible, and else at a
+   reduced size, which is described in WARNING if it is not null.  */
+extern QString export_file (const QString &src, const img_tweaks &tw, const QString &path,
+			    const QByteArray &format, int quality, QString *warning = nullptr);
+
+/* The headless batch mode: export every image in INPUTS, which may be files
+   or directories, with its stored tweaks applied.  Returns the exit status.  */
+extern int run_export (const QStringList &inputs, const export_options &);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <QImage>
+
+/* Apply the orientation stored in img_tweaks to an image: an optional horizontal
+   mirror followed by a clockwise rotation by ROT, which must be a multiple of 90.
+   This is equivalent to QImage::transformed with QTransform ().rotate (rot).scale (-1, 1),
+   but uses a cache-blocked, multithreaded copy instead of a generic transformation.
+   An image that needs no change is returned as a shallow copy.  */
+extern QImage rotate_image (const QImage &src, int rot, bool mirror);
+
+/* Return the size of SZ after rotating it by ROT.  */
+static inline QSize rotated_size (QSize sz, int rot)
+{
+	if (rot == 90 || rot == 270)
+		sz.transpose ();
+	return sz;
+}
+
+#endif
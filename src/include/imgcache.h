@@ -0,0 +1,68 @@
+#ifndef IMGCACHE_H
+#define IMGCACHE_H
+
+#include <list>
+#include <memory>
+
+#include <QString>
+#include <QHash>
+#include <QDateTime>
+
+struct img;
+class QFileInfo;
+
+/* Decoded and rendered images, keyed by the MD5 of the file contents.  This is
+   independent of the directory being shown: entries of the model only hold
+   references, so leaving a directory and coming back, or finding a copy of a
+   file seen before, does not require decoding it again.
+
+   Since adjustments are stored per hash as well, everything an img holds is
+   valid for every file with that hash; each of its renders says what tweaks
+   and size it was made for.  */
+class image_cache
+{
+	struct cached
+	{
+		std::shared_ptr<img> images;
+		std::list<QString>::iterator lru;
+	};
+	QHash<QString, cached> m_by_hash;
+	/* Most recently used at the front.  */
+	std::list<QString> m_lru;
+
+	/* Hashes of files we have read, so that a file that hasn't changed need
+	   not be read again to find its hash.  The key is the file_id, so hard
+	   links are found too.  */
+	struct file_record
+	{
+		QDateTime mtime;
+		qint64 size;
+		QString hash;
+	};
+	QHash<QString, file_record> m_files;
+
+	/* Lookups by hash, for the performance overlay.  */
+	int m_hits = 0;
+	int m_misses = 0;
+
+public:
+	/* The hash of the file described by INFO if it was seen before, and has the
+	   same size and modification time now.  Otherwise an empty string.
+	   ID is the file_id if the caller knows it, otherwise it is looked up.  */
+	QString known_hash (const QFileInfo &info, const QString &id) const;
+	void remember_file (const QFileInfo &info, const QString &id, const QString &hash);
+
+	std::shared_ptr<img> find (const QString &hash);
+	void insert (const QString &hash, std::shared_ptr<img>);
+
+	/* Drop older renders, and then the least recently used images that nobody
+	   else references, until no more than BUDGET bytes remain.  Must only be
+	   called while the renderer is not working on any of them.  */
+	void prune (qint64 budget);
+	/* Memory used by all cached images.  */
+	qint64 bytes () const;
+	int hits () const { return m_hits; }
+	int misses () const { return m_misses; }
+};
+
+#endif
@@ -7,49 +7,91 @@
 #include <QAbstractItemModel>
 
 #include <memory>
+#include <vector>
 
-struct img
+#include "tweaks.h"
+#include "linearbuf.h"
+
+/* What the renderer made of an image with one set of tweaks.  Never changed
+   once it is published: each render publishes a new one, sharing whatever
+   it could reuse from the previous one.  */
+struct render_result
 {
-	QDateTime mtime;
-	QPixmap on_disk;
-	QImage linear {};
+	/* The tweaks the images below were rendered with.  These are the tweaks of
+	   the entry only if they were enabled.  */
+	img_tweaks tweaks;
+
+	linear_buffer linear {};
+	/* Statistics of the linear image, only valid if HAVE_STATS is set.  They
+	   are not computed for images rendered without colour tweaks.  */
 	int l_maxr = 0, l_maxg = 0, l_maxb = 0;
 	int l_minr = 0, l_ming = 0, l_minb = 0, l_minavg = 0;
+	bool have_stats = false;
+	/* The colour-corrected image in its original orientation.  Rotating or
+	   mirroring only needs to transform this, not rerun the tweaks.  */
+	QImage corrected_src {};
 	QPixmap corrected {};
 	QPixmap scaled {};
+
+	/* True if this shows the image with the tweaks TW: scaled to SIZE if
+	   DO_SCALE, otherwise at its own size.  */
+	bool matches (const img_tweaks &tw, bool do_scale, QSize size) const
+	{
+		const QPixmap &pm = do_scale ? scaled : corrected;
+		return (!pm.isNull ()
+			&& tw.same_colours (tweaks)
+			&& tw.rot == tweaks.rot
+			&& tw.mirrored == tweaks.mirrored
+			&& (!do_scale || size == pm.size ()));
+	}
+};
+
+/* The renders kept for an image, most recently used first.  Results in the
+   same set share whatever buffers they could.  */
+typedef std::vector<std::shared_ptr<const render_result>> render_set;
+
+struct img
+{
+	QPixmap on_disk;
 	double border_avgh = 0;
 	double border_avgv = 0;
+	/* Set if on_disk was decoded at a reduced size for the slideshow: the full
+	   size of the image.  */
+	QSize full_size {};
+	/* Set if the image is too large to ever be decoded in full.  on_disk is
+	   then as large as we allow, and is treated as the image itself.  */
+	bool oversized = false;
 
-	/* Information about what was applied to the corrected/scaled images.
-	   Used to decide if they are up-to-date or need to be rerendered.  */
-	int render_rot = 0;
-	bool render_mirror = false;
-	bool render_tweaks = false;
-	int linear_cspace_idx = 0;
+	/* How many renders to keep.  Enough to toggle the tweaks on and off, or
+	   go back and forth between two colour spaces, without rendering again.  */
+	static constexpr size_t max_renders = 4;
 
+	/* The renders of this image, written by the render thread and by the GUI
+	   and read by both without any lock.  Never null.  */
+	std::shared_ptr<const render_set> renders () const
+	{
+		return std::atomic_load (&m_renders);
+	}
+	/* The most recent render, or null.  */
+	std::shared_ptr<const render_result> rendered () const
+	{
+		auto set = renders ();
+		return set->empty () ? nullptr : set->front ();
+	}
+	/* The most recently used render that matches, or null.  */
+	std::shared_ptr<const render_result> find_render (const img_tweaks &, bool do_scale, QSize) const;
+	/* Make R the most recent render, adding it if it is new and dropping the
+	   least recently used one if there are too many.  */
+	void publish (std::shared_ptr<const render_result> r);
+	/* Put R in the place of OLD, if OLD is still kept.  */
+	void replace_render (const std::shared_ptr<const render_result> &old, std::shared_ptr<const render_result> r);
+	/* Drop all renders but the most recent.  */
+	void drop_old_renders ();
 	~img ();
-};
 
-struct img_tweaks
-{
-	/* White balance.  */
-	QColor white = Qt::white;
-	/* An index into a combo box chosen to correspond to values of QColorSpace::NamedColorSpace.
-	   Using an int instead of the enum to be able to signal 0 as default.  */
-	int cspace_idx = 0;
-	int blacklevel = 0;
-	int brightness = 0;
-	/* A range of -100 to 100 given by the GUI, translated into a reasonable 
-	   gamma curve by the rendering code.  */
-	int gamma = 0;
-	int sat = 0;
-	int rot = 0;
-	bool mirrored = false; /* Horizontal */
-
-	QString unknown_tags;
-
-	QString to_string () const;
-	bool from_string (QString s);
+private:
+	template<class F> void update_renders (F f);
+	std::shared_ptr<const render_set> m_renders = std::make_shared<const render_set> ();
 };
 
 struct dir_entry
@@ -57,7 +99,12 @@ struct dir_entry
 	QDir dir;
 	QString name;
 	QString hash;
-	std::unique_ptr<img> images;
+	/* The file_id found by the directory scan, or empty.  */
+	QString file_id;
+	/* Shared with the image cache and with other entries for the same contents.
+	   MTIME is the modification time of this file when they were found.  */
+	std::shared_ptr<img> images;
+	QDateTime mtime;
 	bool isdir = false;
 	img_tweaks tweaks;
 
@@ -73,9 +120,47 @@ struct dir_entry
 		lru_next = nullptr;
 		lru_pprev = nullptr;
 	}
+	/* Take over the place of OTHER in the LRU list.  This keeps the list intact
+	   when the model moves entries around in its vector.  */
+	void lru_take (dir_entry &other)
+	{
+		lru_next = other.lru_next;
+		lru_pprev = other.lru_pprev;
+		other.lru_next = nullptr;
+		other.lru_pprev = nullptr;
+		if (lru_pprev != nullptr)
+			*lru_pprev = this;
+		if (lru_next != nullptr)
+			lru_next->lru_pprev = &lru_next;
+	}
 	dir_entry(QDir d, QString n, bool dir) : dir (std::move (d)), name (std::move (n)), isdir (dir)
 	{
 	}
+	dir_entry (dir_entry &&other) noexcept
+		: dir (std::move (other.dir)), name (std::move (other.name)), hash (std::move (other.hash)),
+		  file_id (std::move (other.file_id)), images (std::move (other.images)),
+		  mtime (std::move (other.mtime)), isdir (other.isdir), tweaks (std::move (other.tweaks))
+	{
+		lru_take (other);
+	}
+	dir_entry &operator= (dir_entry &&other) noexcept
+	{
+		lru_remove ();
+		dir = std::move (other.dir);
+		name = std::move (other.name);
+		hash = std::move (other.hash);
+		file_id = std::move (other.file_id);
+		images = std::move (other.images);
+		mtime = std::move (other.mtime);
+		isdir = other.isdir;
+		tweaks = std::move (other.tweaks);
+		lru_take (other);
+		return *this;
+	}
+	~dir_entry ()
+	{
+		lru_remove ();
+	}
 	QString path ()
 	{
 		return dir.absoluteFilePath (name);
@@ -84,10 +169,21 @@ struct dir_entry
 
 class simple_fs_model : public QAbstractItemModel
 {
+	/* Entries delivered by a directory scan that have not been added to VEC yet.  */
+	std::vector<dir_entry> m_pending;
+
 public:
 	std::vector<dir_entry> vec;
+	/* Directories come first in VEC.  This is the index of the first file.  */
+	int first_file = 0;
 
 	void reset ();
+	void add_pending (const QDir &, const QStringList &dirs, const QStringList &files, const QStringList &ids);
+	std::vector<int> sort ();
+	int find_entry (const QString &name, bool isdir) const;
+	int insert_entry (dir_entry &&);
+	int rename_entry (int row, const QString &name);
+	void entry_changed (int row);
 	const dir_entry *find (const QModelIndex &) const;
 	virtual QVariant data (const QModelIndex &index, int role = Qt::DisplayRole) const override;
 	QModelIndex index (int row, int col = 0, const QModelIndex &parent = QModelIndex()) const override;
@@ -95,6 +191,8 @@ public:
 	int rowCount (const QModelIndex &parent = QModelIndex()) const override;
 	int columnCount (const QModelIndex &parent = QModelIndex()) const override;
 	bool removeRows (int row, int count, const QModelIndex &parent = QModelIndex()) override;
+	bool canFetchMore (const QModelIndex &parent = QModelIndex()) const override;
+	void fetchMore (const QModelIndex &parent = QModelIndex()) override;
 };
 
 #endif
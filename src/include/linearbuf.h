@@ -0,0 +1,52 @@
+#ifndef LINEARBUF_H
+#define LINEARBUF_H
+
+#include <cstdint>
+#include <memory>
+
+#include <QImage>
+#include <QColorSpace>
+
+/* An image with a linear transfer function, as the colour tweaks work on it.
+   Each channel is a separate plane of 16 bit values, so that a loop over one
+   channel reads contiguous memory.  There is only an alpha plane if the source
+   had an alpha channel, which saves a quarter of the memory of Format_RGBA64
+   for opaque photos.  Rows start at 64 byte boundaries.
+
+   Copies share the pixels, like QImage, but there is no copy on write: the
+   pixels may only be written before the buffer is shared.  */
+class linear_buffer
+{
+	std::shared_ptr<uint16_t> m_data;
+	int m_width = 0, m_height = 0;
+	int m_planes = 0;
+	/* Distance between rows, in values.  */
+	qsizetype m_stride = 0;
+	QColorSpace m_cs;
+
+public:
+	enum { red, green, blue, alpha };
+
+	linear_buffer () = default;
+	linear_buffer (QSize sz, bool has_alpha, const QColorSpace &cs);
+
+	/* Split LINEAR, which must be in Format_RGBA64, into planes.  The alpha
+	   channel is only kept if HAS_ALPHA.  */
+	static linear_buffer from_image (const QImage &linear, bool has_alpha);
+	/* The inverse, for comparisons and debugging.  */
+	QImage to_image () const;
+
+	bool is_null () const { return m_data == nullptr; }
+	int width () const { return m_width; }
+	int height () const { return m_height; }
+	QSize size () const { return QSize (m_width, m_height); }
+	bool has_alpha () const { return m_planes == 4; }
+	qsizetype stride () const { return m_stride; }
+	const QColorSpace &color_space () const { return m_cs; }
+	qsizetype size_in_bytes () const { return m_planes * m_stride * m_height * (qsizetype)sizeof (uint16_t); }
+
+	uint16_t *row (int plane, int y) { return m_data.get () + (plane * (qsizetype)m_height + y) * m_stride; }
+	const uint16_t *row (int plane, int y) const { return m_data.get () + (plane * (qsizetype)m_height + y) * m_stride; }
+};
+
+#endif
@@ -2,16 +2,23 @@
 #define MAINWINDOW_H
 
 #include <cstdio>
+#include <deque>
+#include <random>
+#include <functional>
 
 #include <QMainWindow>
 #include <QGraphicsScene>
 #include <QImage>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QDialog>
 #include <QSettings>
 #include <QSqlDatabase>
+#include <QLabel>
 
 #include "imgentry.h"
+#include "imgcache.h"
+#include "pipeline.h"
 
 // RAII wrapper around temporarily setting m_inhibit_updates in MainWindow
 class bool_changer
@@ -46,28 +53,48 @@ namespace Ui
 };
 
 class ClickablePixmap;
+class DirScanner;
+class DirWatcher;
 class QActionGroup;
 class QKeyEvent;
+struct slide_decode;
 
 #include <QMutex>
 #include <QSemaphore>
 #include <QThreadPool>
 
+/* Everything the renderer needs for one image, by value, so that nothing the
+   GUI does while the render runs can affect it.  */
+struct render_job
+{
+	int idx = -1;
+	int gen = 0;
+	/* Where to publish the result.  Also keeps the images alive, even if
+	   their entry is removed or drops them.  */
+	std::shared_ptr<img> images;
+	QPixmap source;
+	/* The tweaks to apply: those of the entry if they are enabled, none
+	   otherwise.  */
+	img_tweaks tweaks;
+	QSize size;
+};
+Q_DECLARE_METATYPE (render_job)
+
 class Renderer : public QObject
 {
 	Q_OBJECT
 	QThreadPool m_pool;
 public:
-
-	// One big mutex around the drawing function
-	QMutex mutex;
-
 	QSemaphore completion_sem { 1 };
 
 	std::atomic<bool> abort_render { false };
+	/* The model generation jobs are wanted for.  A job from an older one
+	   stops between stages and publishes nothing.  */
+	std::atomic<int> wanted_gen { 0 };
 
 	void do_render ();
-	void slot_render (int idx, int gen, img *, img_tweaks *, int w, int h, bool);
+	std::shared_ptr<const render_result> render (const render_job &);
+	void slot_render (render_job);
 signals:
 	void signal_render_complete (int idx, int gen);
 };
@@ -79,29 +106,34 @@ class MainWindow: public QMainWindow
 	Ui::MainWindow *ui;
 
 	QThread *m_render_thread {};
+	QThread *m_scan_thread {};
 
 	QTimer m_setup_timer;
 	QTimer m_resize_timer;
 	QTimer m_slide_timer;
 	QTimer m_db_timer;
+	QTimer m_fetch_timer;
 
 	QSqlDatabase m_db;
 	QStringList m_db_queue;
 
 	Renderer *m_renderer;
 	bool m_render_queued = false;
+	/* The entry currently being rendered, kept up to date if rows move.  */
+	int m_render_idx = -1;
 	struct imgq
 	{
 		int idx;
-		bool changed;
 		bool load;
-		imgq (int i, bool c = false, bool l = false) : idx (i), changed (c), load (l)
+		imgq (int i, bool l = false) : idx (i), load (l)
 		{
 		}
 	};
 	std::vector<imgq> m_queue;
 
 	bool m_individual_files = false;
+	/* Show all images below m_cwd as one list, named by their relative paths.  */
+	bool m_recursive = false;
 
 	QGraphicsScene m_canvas;
 	QGraphicsPixmapItem *m_img {};
@@ -116,17 +148,66 @@ class MainWindow: public QMainWindow
 	int m_cur_img_nlink = 0;
 
 	QDir m_cwd;
+	DirScanner *m_scanner;
+	DirWatcher *m_watcher;
+	/* The name of the entry to select once a directory scan finds it.  */
+	QString m_scan_select;
+	bool m_scanning = false;
+	/* Changes in the directory that arrived while it was being scanned.  */
+	std::vector<std::function<void ()>> m_deferred_fs;
 	std::unique_ptr<QSettings> m_img_settings;
 	simple_fs_model m_model;
+	image_cache m_cache;
+	qint64 m_cache_budget = 1024 * 1024 * 1024;
 	int m_model_gen = 0;
 	int m_idx = -1;
-	int m_first_file_idx = -1;
 	dir_entry *m_lru {};
 	img_tweaks m_copied_tweaks;
 	img_tweaks m_no_tweaks;
 
 	bool m_sliding = false;
-	int m_next_slide = -1;
+	/* The slideshow goes through a shuffled list of the files, and starts on
+	   a new shuffle when it has shown all of them.  */
+	std::vector<int> m_slide_order;
+	size_t m_slide_pos = 0;
+	std::mt19937 m_slide_rng { std::random_device {} () };
+	/* The next few frames, decoded and rendered ahead of time so that they
+	   are ready when they are due.  */
+	struct slide_frame
+	{
+		int idx;
+		/* Still being decoded on a worker thread.  */
+		bool decoding = false;
+		slide_frame (int i) : idx (i)
+		{
+		}
+	};
+	std::deque<slide_frame> m_slide_ahead;
+	/* The next frame was not ready when it was due.  It is shown as soon as it
+	   is, and m_slide_late_timer measures by how much it missed.  */
+	bool m_slide_late = false;
+	QElapsedTimer m_slide_late_timer;
+	/* Fraction of the screen size to decode frames at.  Lowered when frames
+	   miss their deadline, and slowly raised again while they don't.  */
+	double m_slide_quality = 1;
+	int m_slide_on_time_run = 0;
+	struct
+	{
+		int shown, late;
+		qint64 late_ms, max_late_ms;
+	} m_slide_stats {};
+
+	/* Latencies from a key press that changes the image to the first image
+	   on screen, which may be a preview from the unrendered file, and to the
+	   final rendered one.  */
+	QElapsedTimer m_nav_timer;
+	bool m_nav_first_pending = false;
+	bool m_nav_final_pending = false;
+	std::vector<double> m_nav_first_ms;
+	std::vector<double> m_nav_final_ms;
+	/* The performance overlay on the image view.  */
+	QLabel *m_hud {};
+	QTimer m_hud_timer;
 
 	bool m_inhibit_updates = false;
 
@@ -139,11 +220,17 @@ class MainWindow: public QMainWindow
 
 	void add_to_lru (dir_entry &);
 	void prune_lru (int leave = 5);
-	void clear_lru ();
 
 	void update_model_gen ();
 
 	void slide_elapsed ();
+	void show_slide ();
+	void fill_slide_queue ();
+	void prepare_slide (slide_frame &);
+	bool slide_ready (const slide_frame &);
+	void autoblack_measured (const std::shared_ptr<img> &, const linear_stats &);
+	int slide_decode_size ();
+	void slide_decoded (const slide_decode &);
 	void perform_resizes ();
 
 	void zoom_in (bool = false);
@@ -183,6 +270,9 @@ class MainWindow: public QMainWindow
 	void keyReleaseEvent (QKeyEvent *) override;
 
 	void update_background ();
+	void start_nav_timing ();
+	void update_hud ();
+	void print_latencies ();
 
 	void update_selection ();
 	void next_image (bool);
@@ -192,19 +282,32 @@ class MainWindow: public QMainWindow
 	void files_doubleclick ();
 
 	void restart_render ();
-	void enqueue_render (int, bool changed = false, bool load = false);
+	void enqueue_render (int, bool load = false);
 
 	QString load (int idx, bool queue = true);
 	void load_adjustments (dir_entry &);
 	QSize size_for_image (const dir_entry &, bool);
+	img_tweaks effective_tweaks (const dir_entry &) const;
+	std::shared_ptr<const render_result> find_render (const dir_entry &, bool do_scale, QSize);
+	void rerender_current ();
 	void rescale_current ();
-	bool switch_to (int idx);
+	bool switch_to (int idx, bool timed = false);
 
 	void send_tweaks_to_db (const dir_entry &);
 	void sync_to_db ();
 
 	void discard_entries ();
-	int scan_cwd (QString = QString ());
+	void remap_indices (const std::function<int (int)> &);
+	void scan_cwd (QString = QString ());
+	void slot_scan_batch (int gen, QStringList dirs, QStringList files, QStringList ids);
+	void slot_scan_done (int gen);
+	void fetch_entries ();
+	void remove_entry (int);
+	bool defer_fs_event (std::function<void ()>);
+	void fs_created (QString, bool);
+	void fs_removed (QString, bool);
+	void fs_renamed (QString, QString, bool);
+	void fs_modified (QString);
 	void scan (const QString &);
 
 	void perform_setup ();
@@ -215,11 +318,13 @@ protected:
 	void closeEvent(QCloseEvent *event) override;
 
 public:
-	MainWindow (const QStringList &);
+	MainWindow (const QStringList &, bool recursive = false);
 	~MainWindow ();
+	void stop_threads ();
 
 signals:
-	void signal_render (int idx, int gen, img *, img_tweaks *, int w, int h, bool);
+	void signal_render (render_job);
+	void signal_scan (int gen, QString path, bool recursive);
 
 };
 
@@ -0,0 +1,12 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <functional>
+
+/* Split the range [0, n) into chunks of at least GRAIN elements and call F with
+   each half-open subrange [start, end) on the global thread pool.  Returns when
+   all chunks are done.  The calling thread takes part in the work, so this is
+   safe to use even if the pool is busy.  */
+extern void parallel_for (int n, int grain, const std::function<void (int, int)> &f);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <QImage>
+
+#include "linearbuf.h"
+
+struct img_tweaks;
+
+/* Extremes of the linear image, which the tweaks are scaled against.  */
+struct linear_stats
+{
+	int maxr = 1, maxg = 1, maxb = 1;
+	int minr = 65535, ming = 65535, minb = 65535, minavg = 65535;
+};
+
+/* The colour pipeline shared by the renderer and the exporter.  The steps are
+   separate so that the renderer can keep intermediate results.  */
+
+/* Convert SRC to a planar buffer with a linear transfer function.  CSPACE_IDX
+   overrides the colour space of the file if it is nonzero.  8 bit sRGB sources
+   are decoded through the exact tables in colors.h, which can differ by a few
+   16 bit units from Qt's interpolated conversion in the reference version.  */
+extern linear_buffer linear_image (const QImage &src, int cspace_idx);
+extern linear_stats measure_linear (const linear_buffer &linear);
+/* Combine the statistics of two parts of an image into ST.  */
+extern void merge_stats (linear_stats &st, const linear_stats &other);
+/* Apply the colour tweaks in TW to LINEAR.  The result is still linear, in
+   Format_RGBA64.  */
+extern QImage tweak_linear (const linear_buffer &linear, const img_tweaks &tw, const linear_stats &);
+/* The same, followed by encoding to sRGB.  The result is still in
+   Format_RGBA64 and in the orientation of the source.  */
+extern QImage apply_tweaks (const linear_buffer &linear, const img_tweaks &tw, const linear_stats &);
+
+/* If TW leaves the colours alone and SRC is already in sRGB, return SRC in
+   Format_ARGB32, as the renderer would display it after the steps above.
+   Otherwise return a null image.  Most images are never tweaked, and this
+   spares them the linear buffer altogether.  */
+extern QImage untweaked_image (const QImage &src, const img_tweaks &tw);
+
+/* All of the above, followed by rotating and mirroring.  */
+extern QImage render_full (const QImage &src, const img_tweaks &tw);
+
+/* The original versions of the pixel loops, which the ones above must match
+   exactly, apart from the linearization noted above.  They work on
+   interleaved Format_RGBA64 images.  See reference.cc.  */
+extern QImage reference_linear_image (const QImage &src, int cspace_idx);
+extern linear_stats reference_measure_linear (const QImage &linear);
+extern QImage reference_tweak_linear (const QImage &linear, const img_tweaks &tw, const linear_stats &);
+/* Make the pipeline use the reference versions.  Set at startup from
+   --reference or the EQUIV_REFERENCE environment variable.  */
+extern bool use_reference_pipeline;
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <QImage>
+
+/* Resample SRC to exactly the size SZ, filtering in linear light.
+
+   8-bit images are taken to be sRGB encoded; they are decoded to 16-bit linear
+   values through a table, filtered, and encoded again.  Images in Format_RGBA64
+   are taken to hold linear data already and are filtered as they are.  Colours
+   are weighted by their alpha while filtering.  The result has the format of
+   the source for ARGB32, RGB32 and RGBA64, and ARGB32 for anything else,
+   including ARGB32_Premultiplied.
+
+   Each axis is handled separately: shrinking uses an area average, enlarging a
+   Lanczos-3 filter.  Both passes run on the global thread pool.  */
+extern QImage resample_image (const QImage &src, QSize sz);
+
+#endif
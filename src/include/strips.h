@@ -0,0 +1,44 @@
+#ifndef STRIPS_H
+#define STRIPS_H
+
+#include <QImage>
+#include <QString>
+#include <QByteArray>
+
+class QImageReader;
+
+struct img_tweaks;
+
+/* Roughly the memory the full pipeline needs per pixel, across its buffers.  */
+constexpr qint64 pipeline_bytes_per_pixel = 30;
+
+/* Images with more pixels than this are never decoded in full for display,
+   which keeps a single image at around two gigabytes.  Sources that can be
+   read in strips are exported that way.  */
+constexpr qint64 large_image_pixels = 64 * 1024 * 1024;
+
+/* Pixels per strip, for both reading and writing.  Fewer, larger strips mean
+   less time spent skipping to the start of each strip in the decoder.  */
+constexpr qint64 strip_pixels = 16 * 1024 * 1024;
+
+static inline bool is_large_image (QSize sz)
+{
+	return sz.isValid () && (qint64)sz.width () * sz.height () > large_image_pixels;
+}
+
+/* SZ scaled down, keeping its aspect ratio, so that it has at most PIXELS pixels.  */
+extern QSize limited_size (QSize sz, qint64 pixels);
+
+/* True if READER can decode its image one strip at a time, which Qt only
+   allows through a clip rectangle.  JPEG can; PNG and TIFF cannot.  */
+extern bool can_read_strips (QImageReader &reader);
+
+/* Export the image file at SRC, which can_read_strips, with the tweaks in TW
+   applied as an uncompressed 16 bit TIFF file at DST, without ever holding
+   more than a strip of it in memory.  The rotation and mirroring are stored in the orientation tag rather
+   than applied to the pixels.  Returns an error message, or an empty string on
+   success.  */
+extern QString export_streaming (const QString &src, const QByteArray &src_format,
+				 const img_tweaks &tw, const QString &dst);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+
+class QString;
+
+/* Optional tracing of where the time goes between a key press and the image
+   on screen.  When enabled, spans are recorded into a ring buffer per thread,
+   and written as Chrome trace JSON (for chrome://tracing or Perfetto) when
+   the program exits.  When disabled, a span costs one relaxed load.  */
+
+extern std::atomic<bool> trace_enabled;
+
+/* Enable tracing; trace_write will write the events to PATH.  */
+extern void trace_start (const QString &path);
+extern void trace_write ();
+
+extern uint64_t trace_now ();
+/* NAME must be a string literal, only the pointer is stored.  ARG is shown
+   with the event if it is not negative, usually an index into the model.  */
+extern void trace_record (const char *name, uint64_t start, uint64_t end, int arg);
+extern void trace_instant (const char *name, int arg = -1);
+
+/* Records the time from its construction until it goes out of scope, or until
+   end is called.  */
+class trace_span
+{
+	const char *m_name;
+	int m_arg;
+	bool m_on;
+	uint64_t m_start = 0;
+
+public:
+	trace_span (const char *name, int arg = -1)
+		: m_name (name), m_arg (arg), m_on (trace_enabled.load (std::memory_order_relaxed))
+	{
+		if (m_on)
+			m_start = trace_now ();
+	}
+	~trace_span ()
+	{
+		end ();
+	}
+	void end ()
+	{
+		if (m_on)
+			trace_record (m_name, m_start, trace_now (), m_arg);
+		m_on = false;
+	}
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef TWEAKS_H
+#define TWEAKS_H
+
+#include <QColor>
+#include <QString>
+
+/* The adjustments made to an image, stored in the database by the MD5 of the
+   file.  */
+struct img_tweaks
+{
+	/* White balance.  */
+	QColor white = Qt::white;
+	/* An index into a combo box chosen to correspond to values of QColorSpace::NamedColorSpace.
+	   Using an int instead of the enum to be able to signal 0 as default.  */
+	int cspace_idx = 0;
+	int blacklevel = 0;
+	int brightness = 0;
+	/* A range of -100 to 100 given by the GUI, translated into a reasonable 
+	   gamma curve by the rendering code.  */
+	int gamma = 0;
+	int sat = 0;
+	int rot = 0;
+	bool mirrored = false; /* Horizontal */
+
+	QString unknown_tags;
+
+	/* True if the colours come out the same with O as with these tweaks.  */
+	bool same_colours (const img_tweaks &o) const
+	{
+		return (white == o.white && cspace_idx == o.cspace_idx && blacklevel == o.blacklevel
+			&& brightness == o.brightness && gamma == o.gamma && sat == o.sat);
+	}
+
+	/* True if any of the tweaks change the colours, as opposed to only the
+	   colour space or the geometry.  */
+	bool changes_colours () const
+	{
+		return blacklevel != 0 || brightness != 0 || sat != 0 || gamma != 0 || white != Qt::white;
+	}
+
+	QString to_string () const;
+	bool from_string (QString s);
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include <cstdlib>
 #include <utility>
 #include <algorithm>
+#include <numeric>
 
 #include <time.h>
 
@@ -27,12 +28,21 @@
 #include <QElapsedTimer>
 #include <QCryptographicHash>
 #include <QDebug>
-#include <QRegularExpression>
 #include <QScrollBar>
+#include <QBuffer>
+#include <QFontDatabase>
 
 #include "equiv.h"
 #include "colors.h"
 #include "imgentry.h"
+#include "imgcache.h"
+#include "geometry.h"
+#include "dirscan.h"
+#include "pipeline.h"
+#include "decode.h"
+#include "export.h"
+#include "trace.h"
+#include "bufpool.h"
 #include "util-widgets.h"
 
 #include "prefsdlg.h"
@@ -45,139 +55,41 @@ img::~img ()
 {
 }
 
-QString img_tweaks::to_string () const
-{
-	QString str;
-	if (blacklevel != 0)
-		str += "bk:" + QString::number (blacklevel) + ";";
-	if (gamma != 0)
-		str += "g:" + QString::number (gamma) + ";";
-	if (white != Qt::white)
-		str += "wb:" + QString::number (white.red ()) + "," + QString::number (white.green ())+ "," + QString::number (white.blue ()) + ";";
-	if (sat != 0)
-		str += "s:" + QString::number (sat) + ";";
-	if (brightness != 0)
-		str += "br:" + QString::number (brightness) + ";";
-	if (rot != 0)
-		str += "rot:" + QString::number (rot) + ";";
-	if (mirrored != 0)
-		str += "mir;";
-	if (cspace_idx != 0)
-		str += "cs:" + QString::number (cspace_idx) + ";";
-	str += unknown_tags;
-	return str;
-}
-
-// Return true for obsolete forms that we should rewrite.
-bool img_tweaks::from_string (QString s)
-{
-	static QRegularExpression re1 ("(\\d+),(-?\\d+),(\\d+),(\\d+),(\\d+),(-?\\d+),(-?\\d+)");
-	static QRegularExpression re2 ("(\\d+),(-?\\d+),(\\d+),(\\d+),(\\d+),(-?\\d+)");
-	static QRegularExpression re3 ("(\\d+),(-?\\d+),(\\d+),(\\d+),(\\d+)");
-
-	auto result1 = re1.match (s);
-	if (result1.hasMatch ()) {
-		blacklevel = result1.captured (1).toInt ();
-		gamma = result1.captured (2).toInt ();
-		white.setRed (result1.captured (3).toInt ());
-		white.setGreen (result1.captured (4).toInt ());
-		white.setBlue (result1.captured (5).toInt ());
-		sat = result1.captured (6).toInt ();
-		brightness = result1.captured (7).toInt ();
-		unknown_tags = QString ();
-		return true;
-	}
-	auto result2 = re2.match (s);
-	if (result2.hasMatch ()) {
-		blacklevel = result2.captured (1).toInt ();
-		gamma = result2.captured (2).toInt ();
-		white.setRed (result2.captured (3).toInt ());
-		white.setGreen (result2.captured (4).toInt ());
-		white.setBlue (result2.captured (5).toInt ());
-		sat = result2.captured (6).toInt ();
-		unknown_tags = QString ();
-		return true;
-	}
-	auto result3 = re3.match (s);
-	if (result3.hasMatch ()) {
-		blacklevel = result3.captured (1).toInt ();
-		gamma = result3.captured (2).toInt ();
-		white.setRed (result3.captured (3).toInt ());
-		white.setGreen (result3.captured (4).toInt ());
-		white.setBlue (result3.captured (5).toInt ());
-		sat = 0;
-		unknown_tags = QString ();
-		return true;
-	}
-
-	static QRegularExpression re_b ("bk:(\\d+);");
-	static QRegularExpression re_wb ("wb:(\\d+),(\\d+),(\\d+);");
-	static QRegularExpression re_sat ("s:(-?\\d+);");
-	static QRegularExpression re_gamma ("g:(-?\\d+);");
-	static QRegularExpression re_brite ("br:(-?\\d+);");
-	static QRegularExpression re_rot ("rot:(\\d+);");
-	static QRegularExpression re_mir ("mir;");
-	static QRegularExpression re_cs ("cs:(\\d+);");
-	auto result_b = re_b.match (s);
-	auto result_wb = re_wb.match (s);
-	auto result_sat = re_sat.match (s);
-	auto result_gamma = re_gamma.match (s);
-	auto result_brite = re_brite.match (s);
-	auto result_rot = re_rot.match (s);
-	auto result_mir = re_mir.match (s);
-	auto result_cs = re_cs.match (s);
-	if (result_b.hasMatch ())
-		blacklevel = result_b.captured (1).toInt ();
-	if (result_sat.hasMatch ()
-	    /* Using a single letter "s:" was a poor choice, and then using "cs:" was also a
-	       poor choice.  */
-	    && !result_cs.hasMatch () || result_sat.capturedStart (1) != result_cs.capturedStart (1))
-	{
-		sat = result_sat.captured (1).toInt ();
-	}
-	if (result_gamma.hasMatch ())
-		gamma = result_gamma.captured (1).toInt ();
-	if (result_brite.hasMatch ())
-		brightness = result_brite.captured (1).toInt ();
-	if (result_rot.hasMatch ())
-		rot = result_rot.captured (1).toInt ();
-	mirrored = result_mir.hasMatch ();
-	if (result_wb.hasMatch ()) {
-		white.setRed (result_wb.captured (1).toInt ());
-		white.setGreen (result_wb.captured (2).toInt ());
-		white.setBlue (result_wb.captured (3).toInt ());
-	}
-	if (result_cs.hasMatch ())
-		cspace_idx = result_cs.captured (1).toInt ();
-	if (result_cs.hasMatch () && result_sat.hasMatch ()
-	    && result_sat.capturedStart (1) != result_cs.capturedStart (1) && sat == cspace_idx) {
-		printf ("oops\n");
-	}
-	s.replace (re_b, "");
-	s.replace (re_wb, "");
-	s.replace (re_sat, "");
-	s.replace (re_gamma, "");
-	s.replace (re_brite, "");
-	s.replace (re_rot, "");
-	s.replace (re_mir, "");
-	s.replace (re_cs, "");
-	unknown_tags = s;
-#if 0
-	if (!s.isEmpty ())
-		qDebug () << "unknown tags: " << s;
-#endif
-	return false;
-}
-
 void MainWindow::start_threads ()
 {
 	m_render_thread = new QThread;
+	m_render_thread->setObjectName ("renderer");
 	m_render_thread->start ();
 	m_renderer = new Renderer;
+	qRegisterMetaType<render_job> ();
 	m_renderer->moveToThread (m_render_thread);
 	connect (m_render_thread, &QThread::finished, m_renderer, &QObject::deleteLater);
 	connect (m_renderer, &Renderer::signal_render_complete, this, &MainWindow::slot_render_complete);
 	connect (this, &MainWindow::signal_render, m_renderer, &Renderer::slot_render);
+
+	m_scan_thread = new QThread;
+	m_scan_thread->setObjectName ("scanner");
+	m_scan_thread->start ();
+	m_scanner = new DirScanner;
+	m_scanner->moveToThread (m_scan_thread);
+	connect (m_scan_thread, &QThread::finished, m_scanner, &QObject::deleteLater);
+	connect (m_scanner, &DirScanner::signal_batch, this, &MainWindow::slot_scan_batch);
+	connect (m_scanner, &DirScanner::signal_done, this, &MainWindow::slot_scan_done);
+	connect (this, &MainWindow::signal_scan, m_scanner, &DirScanner::slot_scan);
+}
+
+/* Stop all work in other threads, at exit.  A render or scan in progress
+   stops early, and decodes and measurements on the global pool finish.  */
+void MainWindow::stop_threads ()
+{
+	m_renderer->abort_render = true;
+	m_renderer->wanted_gen = -1;
+	m_scanner->wanted_gen = -1;
+	m_render_thread->quit ();
+	m_scan_thread->quit ();
+	m_render_thread->wait ();
+	m_scan_thread->wait ();
+	QThreadPool::globalInstance ()->waitForDone ();
 }
 
 // Called only when the render thread is idle.
@@ -192,7 +104,7 @@ void MainWindow::prune_lru (int leave)
 	while (*pnext) {
 		dir_entry *e = *pnext;
 		e->lru_remove ();
-		/* Discard images.  */
+		/* Let go of the images.  The cache frees them once it needs the space.  */
 		e->images = nullptr;
 		// printf ("Discarded %d: %s\n", (int)(e - &m_model.vec[0]), e->name.toStdString ().c_str ());
 	}
@@ -200,6 +112,9 @@ void MainWindow::prune_lru (int leave)
 				       [&] (auto &elt) -> bool
 				       {
 					       dir_entry &e = m_model.vec[elt.idx];
+					       for (auto &f: m_slide_ahead)
+						       if (f.idx == elt.idx)
+							       return false;
 					       return e.lru_pprev == nullptr && elt.idx != m_idx;
 				       }),
 		    m_queue.end ());
@@ -275,9 +190,13 @@ void MainWindow::image_mouse_event (QMouseEvent *e)
 
 void MainWindow::slot_save_as (bool)
 {
+	if (m_idx == -1)
+		return;
+
 	QSettings settings;
 	QString ipath = settings.value ("paths/images").toString ();
-	QFileDialog dlg (this, tr ("Save image file"), ipath, "PNG (*.png)");
+	QFileDialog dlg (this, tr ("Export image file"), ipath,
+			 tr ("PNG (*.png);;JPEG (*.jpg *.jpeg);;16 bit TIFF (*.tif *.tiff)"));
 	int filesel = settings.value ("filesel").toInt ();
 	if (filesel == 0)
 		dlg.setOption (QFileDialog::DontUseNativeDialog);
@@ -286,19 +205,21 @@ void MainWindow::slot_save_as (bool)
 	if (!dlg.exec ()) {
 		return;
 	}
-#if 0
 	QStringList flist = dlg.selectedFiles ();
-	if (flist.isEmpty ()) {
-		m_paused = false;
-		restart_computation ();
+	if (flist.isEmpty ())
 		return;
-	}
 	QString filename = flist[0];
+	QString suffix = QFileInfo (filename).suffix ().toLower ();
+	QByteArray format = (suffix == "jpg" || suffix == "jpeg" ? "jpeg"
+			     : suffix == "tif" || suffix == "tiff" ? "tiff"
+			     : "png");
 
-	QImage img = current_fd ().julia ? m_img_julia : m_img_mandel;
-	if (!img.save (filename, "png"))
-		QMessageBox::warning (this, PACKAGE, tr ("Failed to save image!"));
-#endif
+	/* Start from the file, not from what is shown, which may be scaled.  */
+	auto &entry = m_model.vec[m_idx];
+	QString err = export_file (entry.path (), ui->tweaksGroupBox->isChecked () ? entry.tweaks : m_no_tweaks,
+				   filename, format, 92);
+	if (!err.isEmpty ())
+		QMessageBox::warning (this, PACKAGE, tr ("Failed to save image: %1").arg (err));
 }
 
 void MainWindow::help_about ()
@@ -321,15 +242,16 @@ void MainWindow::help_about ()
 	mb.exec ();
 }
 
-/* Prepare for a change of the item model by flushing the render thread and
-   increasing the generation number.  */
+/* Prepare for a change of the item model by increasing the generation number.
+   A render still running for the old model stops early; it holds its own
+   references to what it needs, and slot_render_complete ignores it.  */
 void MainWindow::update_model_gen ()
 {
-	/* First, wait for the render thread to complete its current job.  We then flush
-	   the queue so that any call to slot_render_complete just exits.  */
-	m_renderer->completion_sem.acquire ();
-	m_renderer->completion_sem.release ();
 	m_model_gen++;
+	m_render_idx = -1;
+	m_renderer->wanted_gen = m_model_gen;
+	/* Also stop any directory scan that is still running.  */
+	m_scanner->wanted_gen = m_model_gen;
 }
 
 void MainWindow::discard_entries ()
@@ -341,32 +263,233 @@ void MainWindow::discard_entries ()
 	m_idx = -1;
 	ui->action_Rename->setEnabled (false);
 	ui->action_Delete->setEnabled (false);
-	m_next_slide = -1;
+	ui->action_Export->setEnabled (false);
+	m_slide_ahead.clear ();
+	m_slide_order.clear ();
+	m_slide_late = false;
 	delete m_img;
 	m_img = nullptr;
 	m_slide_timer.stop ();
 	m_resize_timer.stop ();
+	m_fetch_timer.stop ();
 	m_sliding = false;
+	m_scanning = false;
+	m_deferred_fs.clear ();
 	m_lru = nullptr;
 	m_queue.clear ();
 	m_model.reset ();
 }
 
-int MainWindow::scan_cwd (QString prev_entry_name)
+/* Rows of the model were inserted, removed or reordered.  Update everything that
+   refers to entries by index.  MAP returns the new index for an old one, or -1
+   if the entry is gone.  */
+void MainWindow::remap_indices (const std::function<int (int)> &map)
 {
-	int new_idx = -1;
-	auto dirlist = m_cwd.entryInfoList (QDir::Dirs | QDir::NoDot, QDir::Name);
-	auto filelist = m_cwd.entryInfoList (QDir::Files, QDir::Name);
-	for (auto &dn: dirlist)
-		m_model.vec.emplace_back (m_cwd, dn.fileName (), true);
-	m_first_file_idx = m_model.vec.size ();
-	for (auto &fn: filelist) {
-		QString s = fn.fileName ();
-		m_model.vec.emplace_back (m_cwd, s, false);
-		if (!prev_entry_name.isEmpty () && s == prev_entry_name)
-			new_idx = m_model.vec.size () - 1;
+	if (m_idx != -1)
+		m_idx = map (m_idx);
+	if (m_render_idx != -1)
+		m_render_idx = map (m_render_idx);
+	for (auto &q: m_queue)
+		q.idx = map (q.idx);
+	m_queue.erase (std::remove_if (m_queue.begin (), m_queue.end (),
+				       [] (const imgq &q) { return q.idx == -1; }),
+		       m_queue.end ());
+	for (auto &f: m_slide_ahead)
+		f.idx = map (f.idx);
+	m_slide_ahead.erase (std::remove_if (m_slide_ahead.begin (), m_slide_ahead.end (),
+					     [] (const slide_frame &f) { return f.idx == -1; }),
+			     m_slide_ahead.end ());
+	/* Keep the position in the shuffled order pointing at the same place.  */
+	size_t kept = 0, pos = m_slide_pos;
+	for (size_t i = 0; i < m_slide_order.size (); i++) {
+		int idx = map (m_slide_order[i]);
+		if (idx == -1) {
+			if (i < m_slide_pos)
+				pos--;
+			continue;
+		}
+		m_slide_order[kept++] = idx;
+	}
+	m_slide_order.resize (kept);
+	m_slide_pos = pos;
+}
+
+/* Start scanning m_cwd in the background.  Entries arrive through slot_scan_batch.
+   If PREV_ENTRY_NAME is given, that entry is selected once it is found.  */
+void MainWindow::scan_cwd (QString prev_entry_name)
+{
+	m_scan_select = prev_entry_name;
+	m_scanning = true;
+	m_scanner->wanted_gen = m_model_gen;
+	/* Start watching first, so that nothing is missed.  Changes that the scan
+	   also sees are merged when the deferred events are applied.  */
+	m_watcher->watch (m_cwd.absolutePath ());
+	emit signal_scan (m_model_gen, m_cwd.absolutePath (), m_recursive);
+}
+
+void MainWindow::slot_scan_batch (int gen, QStringList dirs, QStringList files, QStringList ids)
+{
+	if (gen != m_model_gen)
+		return;
+
+	m_model.add_pending (m_cwd, dirs, files, ids);
+	/* As long as nothing is shown, add entries immediately.  After that, collect
+	   them for a little while so the file view isn't updated for every batch;
+	   the view also fetches them by itself when scrolled to the end.  */
+	if (m_idx == -1)
+		fetch_entries ();
+	else if (!m_fetch_timer.isActive ())
+		m_fetch_timer.start ();
+}
+
+void MainWindow::fetch_entries ()
+{
+	if (!m_model.canFetchMore ())
+		return;
+
+	int old_files = m_model.vec.size () - m_model.first_file;
+	m_model.fetchMore ();
+	if (m_idx != -1)
+		return;
+
+	/* Show the first image as soon as it has been seen.  */
+	for (size_t i = m_model.first_file + old_files; i < m_model.vec.size (); i++)
+		if (m_scan_select.isEmpty () || m_model.vec[i].name == m_scan_select) {
+			switch_to (i);
+			break;
+		}
+}
+
+void MainWindow::slot_scan_done (int gen)
+{
+	if (gen != m_model_gen)
+		return;
+
+	m_fetch_timer.stop ();
+	fetch_entries ();
+	std::vector<int> new_row = m_model.sort ();
+	remap_indices ([&new_row] (int i) { return new_row[i]; });
+	m_scan_select = QString ();
+	if (m_idx == -1) {
+		if ((size_t)m_model.first_file < m_model.vec.size ())
+			switch_to (m_model.first_file);
+	} else
+		ui->fileView->scrollTo (m_model.index (m_idx));
+
+	m_scanning = false;
+	auto deferred = std::move (m_deferred_fs);
+	m_deferred_fs.clear ();
+	for (auto &f: deferred)
+		f ();
+}
+
+/* Remove the entry at ROW from the model, leaving all other entries and their
+   cached images alone.  If it was the current image, show its neighbour.  */
+void MainWindow::remove_entry (int row)
+{
+	bool current = row == m_idx;
+	{
+		bool_changer bc (m_inhibit_updates, true);
+		m_model.removeRows (row, 1);
+	}
+	if (!current)
+		return;
+
+	int n = m_model.vec.size ();
+	row = std::min (row, n - 1);
+	if (row >= m_model.first_file)
+		switch_to (row);
+	else {
+		delete m_img;
+		m_img = nullptr;
+		ui->action_Rename->setEnabled (false);
+		ui->action_Delete->setEnabled (false);
+		ui->action_Export->setEnabled (false);
+	}
+}
+
+/* While a scan is running, the model is not sorted and may not have the entry
+   in question yet.  Keep such changes until the scan is done.  */
+bool MainWindow::defer_fs_event (std::function<void ()> f)
+{
+	if (!m_scanning)
+		return false;
+	m_deferred_fs.push_back (std::move (f));
+	return true;
+}
+
+void MainWindow::fs_created (QString name, bool isdir)
+{
+	if (defer_fs_event ([=] () { fs_created (name, isdir); }))
+		return;
+	/* The recursive view has no directories, and only the top level is watched.  */
+	if (isdir && m_recursive)
+		return;
+	if (isdir ? name.startsWith ('.') : !is_image_name (m_cwd, name))
+		return;
+	if (m_model.find_entry (name, isdir) != -1) {
+		if (!isdir)
+			fs_modified (name);
+		return;
+	}
+	int row = m_model.insert_entry (dir_entry (m_cwd, name, isdir));
+	/* In a directory that had no images, show the first one that appears.  */
+	if (m_idx == -1 && !isdir)
+		switch_to (row);
+}
+
+void MainWindow::fs_removed (QString name, bool isdir)
+{
+	if (defer_fs_event ([=] () { fs_removed (name, isdir); }))
+		return;
+	int row = m_model.find_entry (name, isdir);
+	if (row != -1)
+		remove_entry (row);
+}
+
+void MainWindow::fs_renamed (QString from, QString to, bool isdir)
+{
+	if (defer_fs_event ([=] () { fs_renamed (from, to, isdir); }))
+		return;
+	bool wanted = isdir ? !to.startsWith ('.') : is_image_name (m_cwd, to);
+	int row = m_model.find_entry (from, isdir);
+	if (row == -1) {
+		if (wanted)
+			fs_created (to, isdir);
+		return;
+	}
+	if (!wanted) {
+		remove_entry (row);
+		return;
+	}
+	/* Renaming onto an existing name replaces that file.  */
+	int old = m_model.find_entry (to, isdir);
+	if (old != -1) {
+		remove_entry (old);
+		row = m_model.find_entry (from, isdir);
+	}
+	m_model.rename_entry (row, to);
+}
+
+void MainWindow::fs_modified (QString name)
+{
+	if (defer_fs_event ([=] () { fs_modified (name); }))
+		return;
+	int row = m_model.find_entry (name, false);
+	/* A file without a suffix is only recognized by its contents, which were
+	   not there yet when it was created.  */
+	if (row == -1) {
+		fs_created (name, false);
+		return;
+	}
+	/* It may be a new file under the old name.  */
+	m_model.vec[row].file_id = QString ();
+	m_model.entry_changed (row);
+	/* Other entries notice the new modification time when they are loaded again.  */
+	if (row == m_idx) {
+		load (row);
+		rescale_current ();
 	}
-	return new_idx;
 }
 
 /* Used in only one place: to scan arguments given on the command line.  */
@@ -380,7 +503,6 @@ void MainWindow::scan (const QString &filename)
 			opened = true;
 			m_cwd = f.dir ();
 			m_model.vec.emplace_back (f.dir (), f.fileName (), false);
-			m_first_file_idx = 0;
 		}
 	}
 	if (!opened) {
@@ -423,22 +545,26 @@ void MainWindow::restart_render ()
 	bool_changer bc (reentry_guard, true);
 
 	Renderer *r = m_renderer;
+	trace_span span ("restart_render");
 
-	/* Move the current image to the back.  */
-	auto it = m_queue.begin ();
-	auto end = m_queue.end ();
-	while (it != end) {
-		if (it->idx == m_idx) {
-			std::rotate (it, it + 1, end);
-			assert (m_queue.back ().idx == m_idx);
-			break;
-		}
-		it++;
-	}
+	/* Move the current image to the back, and before it the upcoming slides
+	   in the order they are needed.  */
+	auto to_back = [this] (int idx)
+	{
+		auto it = std::find_if (m_queue.begin (), m_queue.end (), [idx] (const imgq &q) { return q.idx == idx; });
+		if (it != m_queue.end ())
+			std::rotate (it, it + 1, m_queue.end ());
+	};
+	for (auto it = m_slide_ahead.rbegin (); it != m_slide_ahead.rend (); it++)
+		to_back (it->idx);
+	to_back (m_idx);
 
 	for (;;) {
-		if (m_render_queued || m_queue.empty ())
+		if (m_render_queued || m_queue.empty ()) {
+			if (m_render_queued)
+				trace_instant ("renderer_busy", m_render_idx);
 			return;
+		}
 
 		imgq q = m_queue.back ();
 		m_queue.pop_back ();
@@ -448,11 +574,9 @@ void MainWindow::restart_render ()
 			load (q.idx, false);
 		}
 		img *img = entry.images.get ();
-		if (img == nullptr || img->on_disk.isNull ())
+		if (img == nullptr || img->on_disk.isNull ()) {
+			trace_instant ("skip_unloaded", q.idx);
 			continue;
-		if (q.changed) {
-			img->corrected = QPixmap ();
-			img->scaled = QPixmap ();
 		}
 		if (r->completion_sem.available () == 0)
 			abort ();
@@ -460,42 +584,54 @@ void MainWindow::restart_render ()
 		r->completion_sem.acquire ();
 		// printf ("queue render %d\n", q.idx);
 		m_render_queued = true;
-		bool tweaked = ui->tweaksGroupBox->isChecked ();
-		img_tweaks *tw = tweaked ? &entry.tweaks : &m_no_tweaks;
-		QSize sz = size_for_image (entry, false);
-		emit signal_render (q.idx, m_model_gen, entry.images.get (), tw, sz.width (), sz.height (),
-				    tweaked);
+		m_render_idx = q.idx;
+		render_job job;
+		job.idx = q.idx;
+		job.gen = m_model_gen;
+		job.images = entry.images;
+		job.source = img->on_disk;
+		job.tweaks = effective_tweaks (entry);
+		job.size = size_for_image (entry, false);
+		trace_instant ("queue_render", q.idx);
+		emit signal_render (job);
 		break;
 	}
 }
 
-void MainWindow::slot_render_complete (int idx, int gen)
+void MainWindow::slot_render_complete (int, int gen)
 {
-	if (gen != m_model_gen)
-		return;
-
-	// printf ("render complete: %d\n", idx);
+	/* Clear the flag even for a render from an older generation, otherwise
+	   nothing would ever be rendered again.  */
 	m_render_queued = false;
-	prune_lru ();
-	if (idx == m_idx)
-		rescale_current ();
+	int idx = m_render_idx;
+	m_render_idx = -1;
+	if (gen == m_model_gen) {
+		// printf ("render complete: %d\n", idx);
+		prune_lru ();
+		if (idx != -1 && idx == m_idx)
+			rescale_current ();
+		if (m_slide_late && !m_slide_ahead.empty () && slide_ready (m_slide_ahead.front ()))
+			show_slide ();
+	}
+	/* Nothing is being rendered now, so this is a good time to let go of images.  */
+	m_cache.prune (m_cache_budget);
 	restart_render ();
 }
 
-void MainWindow::enqueue_render (int idx, bool changed, bool load)
+void MainWindow::enqueue_render (int idx, bool load)
 {
 	for (auto &q: m_queue)
 		if (q.idx == idx) {
-			q.changed |= changed;
 			q.load |= load;
 			return;
 		}
-	m_queue.emplace_back (idx, changed, load);
+	m_queue.emplace_back (idx, load);
 	restart_render ();
 }
 
 void MainWindow::load_adjustments (dir_entry &e)
 {
+	trace_span span ("db_lookup");
 	QSqlQuery q (m_db);
 	QString qstr = QString ("select tweaks from img_tweaks where md5=\'%1\'").arg (e.hash);
 	// qDebug () << qstr;
@@ -509,69 +645,59 @@ void MainWindow::load_adjustments (dir_entry &e)
 QString MainWindow::load (int idx, bool do_queue)
 {
 	auto &entry = m_model.vec[idx];
-	if (!entry.images)
-		entry.images = std::make_unique<img> ();
+	trace_span span ("load", idx);
 	QString path = entry.path ();
 	QFileInfo info (path);
-	if (entry.images->on_disk.isNull () || entry.images->mtime != info.lastModified ())
+	if (entry.images != nullptr && entry.mtime != info.lastModified ()) {
+		/* The file was modified.  The old images remain cached under the old hash,
+		   and the renderer holds its own reference if it is still using them.  */
+		entry.images = nullptr;
+		/* We'll load new adjustments, if any, later.  */
+		entry.tweaks = m_no_tweaks;
+	}
+	if (entry.images == nullptr || entry.images->on_disk.isNull ()
+	    || (entry.images->full_size.isValid () && !entry.images->oversized && !m_sliding))
 	{
-		if (!entry.images->on_disk.isNull ()) {
-			/* Files were modified.  Flush the render thread, then remove old images.  */
-			m_renderer->completion_sem.acquire ();
-			m_renderer->completion_sem.release ();
-			entry.images->linear = QImage ();
-			entry.images->corrected = QPixmap ();
-			entry.images->scaled = QPixmap ();
-			/* We'll load new adjustments, if any, later.  */
-			entry.tweaks = m_no_tweaks;
-		}
-		QPixmap pm;
-		if (!pm.load (path)) {
-			entry.hash = QString ();
-			return QString ();
+		QString hash = m_cache.known_hash (info, entry.file_id);
+		if (hash.isEmpty ()) {
+			trace_span read_span ("read_md5", idx);
+			hash = hash_file (path);
+			read_span.end ();
+			if (hash.isEmpty ()) {
+				entry.hash = QString ();
+				entry.images = std::make_shared<img> ();
+				return QString ();
+			}
+			m_cache.remember_file (info, entry.file_id, hash);
 		}
-		int w = pm.width ();
-		int h = pm.height ();
-		if (w > 2 && h > 2) {
-			QImage img = pm.toImage ();
-			uint64_t ravg = 0;
-			uint64_t gavg = 0;
-			uint64_t bavg = 0;
-			for (int x = 1; x < w - 1; x++) {
-				QColor c1 = img.pixel (x, 0);
-				QColor c2 = img.pixel (x, h - 1);
-				ravg += c1.red () + c2.red ();
-				gavg += c1.green () + c2.green ();
-				bavg += c1.blue () + c2.blue ();
+		entry.hash = hash;
+		entry.mtime = info.lastModified ();
+		entry.images = m_cache.find (hash);
+		/* Outside the slideshow, we want the image at its full size.  */
+		if (entry.images != nullptr && entry.images->full_size.isValid () && !entry.images->oversized
+		    && !m_sliding)
+			entry.images = nullptr;
+		if (entry.images == nullptr) {
+			/* Keep an empty img around even if loading fails, the rest of the
+			   code relies on it.  */
+			entry.images = std::make_shared<img> ();
+			trace_span decode_span ("decode", idx);
+			decoded_image d = decode_image (path);
+			decode_span.end ();
+			if (d.image.isNull ()) {
+				entry.hash = QString ();
+				return QString ();
 			}
-			entry.images->border_avgh = ravg * l_factor_r + gavg * l_factor_g + bavg * l_factor_b;
-			entry.images->border_avgh /= 2 * (w - 2);
-			entry.images->border_avgh /= 255;
-			ravg = gavg = bavg = 0;
-			for (int y = 0; y < h; y++) {
-				QColor c1 = img.pixel (0, y);
-				QColor c2 = img.pixel (w - 1, y);
-				ravg += c1.red () + c2.red ();
-				gavg += c1.green () + c2.green ();
-				bavg += c1.blue () + c2.blue ();
+			trace_span border_span ("border", idx);
+			border_averages (d.image, entry.images->border_avgh, entry.images->border_avgv);
+			border_span.end ();
+			entry.images->on_disk = QPixmap::fromImage (d.image);
+			if (d.oversized) {
+				entry.images->full_size = d.full_size;
+				entry.images->oversized = true;
 			}
-			entry.images->border_avgv = ravg * l_factor_r + gavg * l_factor_g + bavg * l_factor_b;
-			entry.images->border_avgv /= 2 * h;
-			entry.images->border_avgv /= 255;
+			m_cache.insert (hash, entry.images);
 		}
-		QFile f (path);
-		f.open (QIODevice::ReadOnly);
-		// MD5 is apparently quite bad, but it is supposed to be used to
-		// identify thumbnail files. If we ever want to support thumbnails,
-		// it makes little sense to compute two different hashes for the same file.
-		// So, stick with MD5. It's not like correct white balance is likely to
-		// be security relevant.
-		QCryptographicHash hash (QCryptographicHash::Md5);
-		hash.addData (&f);
-		f.close ();
-		entry.hash = hash.result ().toBase64 (QByteArray::Base64UrlEncoding | QByteArray::OmitTrailingEquals);
-		entry.images->mtime = info.lastModified ();
-		entry.images->on_disk = pm;
 		load_adjustments (entry);
 		if (do_queue)
 			enqueue_render (idx);
@@ -624,7 +750,7 @@ QSize MainWindow::size_for_image (const dir_entry &entry, bool shown)
 
 	update_background ();
 
-	QSize img_sz = img->on_disk.size ();
+	QSize img_sz = img->full_size.isValid () && !img->oversized ? img->full_size : img->on_disk.size ();
 	if (entry.tweaks.rot == 90 || entry.tweaks.rot == 270)
 		img_sz.transpose ();
 
@@ -648,6 +774,32 @@ QSize MainWindow::size_for_image (const dir_entry &entry, bool shown)
 	return wanted_sz;
 }
 
+/* The tweaks ENTRY is rendered with.  */
+img_tweaks MainWindow::effective_tweaks (const dir_entry &entry) const
+{
+	return ui->tweaksGroupBox->isChecked () ? entry.tweaks : m_no_tweaks;
+}
+
+/* A render of ENTRY that is up to date with its tweaks and has the image to
+   show: if DO_SCALE, scaled to the size WANTED_SZ.  Null if there is none.  */
+std::shared_ptr<const render_result> MainWindow::find_render (const dir_entry &entry, bool do_scale, QSize wanted_sz)
+{
+	return entry.images->find_render (effective_tweaks (entry), do_scale, wanted_sz);
+}
+
+/* Show the current image with tweaks that just changed: at once if a render
+   for them is still kept, otherwise once the renderer is done.  Going back and
+   forth between two sets of tweaks then costs nothing after the first time.  */
+void MainWindow::rerender_current ()
+{
+	auto &entry = m_model.vec[m_idx];
+	bool do_scale = ui->scaleComboBox->currentIndex () > 0 || m_free_scale != 1;
+	if (find_render (entry, do_scale, size_for_image (entry, true)))
+		rescale_current ();
+	else
+		enqueue_render (m_idx);
+}
+
 void MainWindow::rescale_current ()
 {
 	if (m_idx == -1)
@@ -661,60 +813,62 @@ void MainWindow::rescale_current ()
 	if (img->on_disk.isNull ())
 		return;
 
+	trace_span span ("rescale_current", m_idx);
 	update_background ();
 
-	Renderer *r = m_renderer;
-	r->mutex.lock ();
-	/* See if the renderer has completed a usable image. This is verified a bit more
-	   a little further down.  */
-	QPixmap preferred = do_scale ? img->scaled : img->corrected;
-	r->mutex.unlock ();
-
 	// line_terminator lt (stdout);
 
 	QSize wanted_sz = size_for_image (entry, true);
 
-	bool preferred_good = false;
-	if (!preferred.isNull ()) {
-		QSize existing_sz = preferred.size ();
-		// printf ("found preferred %d x %d", existing_sz.width (), existing_sz.height ());
-		if (entry.tweaks.rot == entry.images->render_rot
-		    && entry.tweaks.mirrored == entry.images->render_mirror
-		    && (!ui->tweaksGroupBox->isChecked ()
-			|| entry.tweaks.cspace_idx == entry.images->linear_cspace_idx)
-		    && ui->tweaksGroupBox->isChecked () == entry.images->render_tweaks
-		    && (!do_scale || wanted_sz == existing_sz))
-		{
-			preferred_good = true;
-			// printf ("good picture, no work needed ");
-		}
-		if (!preferred_good) {
-			// printf ("enqueue again ");
-			enqueue_render (m_idx);
-		}
-
+	/* See if the renderer has completed a usable image, now or for the
+	   same tweaks and size earlier.  */
+	std::shared_ptr<const render_result> rendered = find_render (entry, do_scale, wanted_sz);
+	bool preferred_good = rendered != nullptr;
+	QPixmap final_img;
+	if (preferred_good) {
+		final_img = do_scale ? rendered->scaled : rendered->corrected;
+		img->publish (rendered);
+	} else if (img->rendered ()) {
+		// printf ("enqueue again ");
+		enqueue_render (m_idx);
 	}
-	QPixmap final_img = preferred;
 	if (!preferred_good) {
+		trace_span fallback_span ("fallback_scale", m_idx);
+		/* Only a preview until the render arrives, and this runs on every
+		   resize, so keep it cheap.  Scale first, in the original orientation,
+		   so that there are fewer pixels to rotate.  */
 		final_img = img->on_disk;
+		if (do_scale)
+			final_img = final_img.scaled (rotated_size (wanted_sz, entry.tweaks.rot),
+						      Qt::IgnoreAspectRatio, Qt::FastTransformation);
 		if (entry.tweaks.rot != 0 || entry.tweaks.mirrored) {
 			QTransform t;
 			t.rotate (entry.tweaks.rot);
 			if (entry.tweaks.mirrored)
-				t.scale(-1, 1);
+				t.scale (-1, 1);
 			final_img = final_img.transformed (t);
 		}
-		if (do_scale)
-			final_img = final_img.scaled (wanted_sz, Qt::KeepAspectRatio, Qt::FastTransformation);
 	}
-	if (m_img && m_img->pixmap ().toImage () == final_img.toImage ()) {
-		// printf ("image good already ");
-	} else {
-		delete m_img;
+	/* Rendered pixmaps are shared, not copied, so the same render shown again
+	   has the same cache key.  */
+	if (m_img == nullptr) {
 		m_img = new QGraphicsPixmapItem (final_img);
 		m_canvas.addItem (m_img);
+	} else if (m_img->pixmap ().cacheKey () != final_img.cacheKey ()) {
+		trace_span set_span ("set_pixmap", m_idx);
+		m_img->setPixmap (final_img);
 	}
 	m_canvas.setSceneRect (m_canvas.itemsBoundingRect ());
+	if (m_nav_first_pending) {
+		m_nav_first_pending = false;
+		m_nav_first_ms.push_back (m_nav_timer.nsecsElapsed () / 1e6);
+	}
+	if (m_nav_final_pending && preferred_good) {
+		m_nav_final_pending = false;
+		m_nav_final_ms.push_back (m_nav_timer.nsecsElapsed () / 1e6);
+	}
+	if (m_hud && m_hud->isVisible ())
+		update_hud ();
 	QSize imgsz = final_img.size ();
 	QSize sz = ui->imageView->viewport ()->size ();
 	QSize newsz = sz - imgsz;
@@ -806,16 +960,6 @@ void MainWindow::update_tweaks_ui (const dir_entry &entry)
 	update_wbcol_button (entry.tweaks.white);
 }
 
-void MainWindow::clear_lru ()
-{
-	while (m_lru != nullptr) {
-		auto *p = m_lru;
-		m_lru = p->lru_next;
-		p->lru_pprev = nullptr;
-		p->lru_next = nullptr;
-	}
-}
-
 void MainWindow::add_to_lru (dir_entry &entry)
 {
 	if (entry.lru_pprev != nullptr)
@@ -827,11 +971,16 @@ void MainWindow::add_to_lru (dir_entry &entry)
 	m_lru = &entry;
 }
 
-bool MainWindow::switch_to (int idx)
+/* Show entry IDX.  If TIMED, the time until it appears is recorded as the
+   latency of a navigation key.  */
+bool MainWindow::switch_to (int idx, bool timed)
 {
 	if (m_idx == idx)
 		return true;
 
+	if (timed)
+		start_nav_timing ();
+
 	/* The current image must not be on the LRU list.  */
 	if (m_idx != -1) {
 		auto &old_entry = m_model.vec[m_idx];
@@ -850,12 +999,15 @@ bool MainWindow::switch_to (int idx)
 	m_idx = idx;
 	ui->action_Rename->setEnabled (idx != -1);
 	ui->action_Delete->setEnabled (idx != -1);
+	ui->action_Export->setEnabled (idx != -1);
 
 	auto &entry = m_model.vec[m_idx];
 	entry.lru_remove ();
 	QString n = load (idx);
 	if (n.isEmpty ()) {
 		ui->sizeLabel->setText ("");
+		/* No image appears, so there is no latency to record.  */
+		m_nav_first_pending = m_nav_final_pending = false;
 		return false;
 	}
 	double v = m_cur_img_size;
@@ -924,9 +1076,7 @@ void MainWindow::slot_rescan (bool)
 		}
 	}
 	discard_entries ();
-	int idx = scan_cwd (cur);
-	if (idx != -1)
-		switch_to (idx);
+	scan_cwd (cur);
 }
 
 void MainWindow::slot_rename (bool)
@@ -936,11 +1086,22 @@ void MainWindow::slot_rename (bool)
 		/* Shouldn't happen.  */
 		return;
 	auto &entry = m_model.vec[m_idx];
+	QString old_name = entry.name;
 	RenameDialog dlg (this, &entry);
-	if (dlg.exec ()) {
-		if (!m_individual_files)
-			slot_rescan ();
+	if (!dlg.exec () || m_individual_files)
+		return;
+
+	/* Edit the model in place, so that everything we have cached survives.
+	   A file moved to a directory we don't show just disappears from the view.  */
+	QString new_name = m_cwd.relativeFilePath (entry.path ());
+	if (new_name.startsWith ("../") || (!m_recursive && new_name.contains ('/'))) {
+		remove_entry (m_idx);
+		return;
 	}
+	entry.dir = m_cwd;
+	entry.name = old_name;
+	m_model.rename_entry (m_idx, new_name);
+	setWindowTitle (QString (PACKAGE) + " (experiment): " + new_name);
 }
 
 void MainWindow::slot_delete (bool)
@@ -956,17 +1117,9 @@ void MainWindow::slot_delete (bool)
 	if (mb.exec () != QMessageBox::Yes)
 		return;
 
-	if (entry.dir.remove (entry.name)) {
-		update_model_gen ();
-		clear_lru ();
-		int idx = m_idx;
-		{
-			bool_changer bc (m_inhibit_updates, true);
-			m_model.removeRows (idx, 1);
-		}
-		m_idx = -1;
-		update_selection ();
-	} else
+	if (entry.dir.remove (entry.name))
+		remove_entry (m_idx);
+	else
 		QMessageBox::warning (this, PACKAGE, tr ("The delete operation failed."));
 }
 
@@ -975,16 +1128,20 @@ void MainWindow::next_image (bool)
 	if (m_idx == -1)
 		return;
 
+	/* While a directory scan is running, more entries may be waiting.  */
+	if (m_idx + 2 >= m_model.vec.size ())
+		fetch_entries ();
+
 	int next = m_idx;
 	while (next + 1 < m_model.vec.size ()) {
 		next++;
-		if (switch_to (next))
+		if (switch_to (next, true))
 			break;
 	}
 	if (next + 1 < m_model.vec.size ()) {
 		next++;
 		add_to_lru (m_model.vec[next]);
-		enqueue_render (next, false, true);
+		enqueue_render (next, true);
 	}
 }
 
@@ -998,7 +1155,7 @@ void MainWindow::prev_image (bool)
 		prev--;
 		if (m_model.vec[prev].isdir)
 			return;
-		if (switch_to (prev))
+		if (switch_to (prev, true))
 			break;
 	}
 	if (prev > 0) {
@@ -1006,47 +1163,252 @@ void MainWindow::prev_image (bool)
 		if (m_model.vec[prev].isdir)
 			return;
 		add_to_lru (m_model.vec[prev]);
-		enqueue_render (prev, false, true);
+		enqueue_render (prev, true);
 	}
 }
 
-void MainWindow::slide_elapsed ()
+/* The result of decoding a file for the slideshow on a worker thread.  */
+struct slide_decode
+{
+	QString path;
+	QFileInfo info;
+	QString hash;
+	QImage image;
+	QSize full_size;
+	bool oversized = false;
+	double border_avgh = 0;
+	double border_avgv = 0;
+};
+
+/* Read and hash the file at PATH, and decode it for a slide of at most MAX_DIM.  */
+static slide_decode decode_for_slideshow (const QString &path, int max_dim)
+{
+	slide_decode r;
+	r.path = path;
+	r.info = QFileInfo (path);
+	/* Make sure the info is cached before it is handed to the GUI thread.  */
+	r.info.lastModified ();
+	r.info.size ();
+
+	QFile f (path);
+	if (!f.open (QIODevice::ReadOnly))
+		return r;
+	QByteArray data = f.readAll ();
+	f.close ();
+	r.hash = encode_hash (QCryptographicHash::hash (data, QCryptographicHash::Md5));
+
+	QBuffer buf (&data);
+	buf.open (QIODevice::ReadOnly);
+	decoded_image d = decode_image (&buf, r.info.suffix ().toLatin1 (), max_dim);
+	r.image = d.image;
+	r.full_size = d.full_size;
+	r.oversized = d.oversized;
+	border_averages (r.image, r.border_avgh, r.border_avgv);
+	return r;
+}
+
+class slide_decode_runner : public QRunnable
+{
+	MainWindow *m_win;
+	QString m_path;
+	int m_max_dim;
+	std::function<void (const slide_decode &)> m_done;
+
+public:
+	slide_decode_runner (MainWindow *win, const QString &path, int max_dim,
+			     std::function<void (const slide_decode &)> done)
+		: m_win (win), m_path (path), m_max_dim (max_dim), m_done (std::move (done))
+	{
+		setAutoDelete (true);
+	}
+	void run () override
+	{
+		slide_decode r = decode_for_slideshow (m_path, m_max_dim);
+		auto done = m_done;
+		QMetaObject::invokeMethod (m_win, [done, r] () { done (r); }, Qt::QueuedConnection);
+	}
+};
+
+/* The largest size we need to decode slides at.  When the image is fit to the
+   window, its longer side is never larger than the longer side of the window,
+   whatever its rotation.  Zero means no limit.  */
+int MainWindow::slide_decode_size ()
 {
-	if (!m_sliding)
+	if (ui->scaleComboBox->currentIndex () < 2)
+		return 0;
+	QSize sz = ui->imageView->viewport ()->size ();
+	return std::max (sz.width (), sz.height ()) * m_slide_quality;
+}
+
+void MainWindow::slide_decoded (const slide_decode &r)
+{
+	auto it = std::find_if (m_slide_ahead.begin (), m_slide_ahead.end (),
+				[&] (const slide_frame &f) { return f.decoding && m_model.vec[f.idx].path () == r.path; });
+	/* The slideshow was stopped, or the file removed.  */
+	if (it == m_slide_ahead.end ())
+		return;
+
+	it->decoding = false;
+	int idx = it->idx;
+	if (r.image.isNull ()) {
+		m_slide_ahead.erase (it);
+		fill_slide_queue ();
+		if (m_slide_late && !m_slide_ahead.empty () && slide_ready (m_slide_ahead.front ()))
+			show_slide ();
 		return;
+	}
+	auto &entry = m_model.vec[idx];
+	m_cache.remember_file (r.info, entry.file_id, r.hash);
+	entry.hash = r.hash;
+	entry.mtime = r.info.lastModified ();
+	auto images = std::make_shared<img> ();
+	images->on_disk = QPixmap::fromImage (r.image);
+	images->border_avgh = r.border_avgh;
+	images->border_avgv = r.border_avgv;
+	if (r.image.size () != r.full_size)
+		images->full_size = r.full_size;
+	images->oversized = r.oversized;
+	entry.images = images;
+	m_cache.insert (r.hash, images);
+	load_adjustments (entry);
+	enqueue_render (idx);
+}
+
+/* Get the images for a slide, without blocking on a decode.  */
+void MainWindow::prepare_slide (slide_frame &f)
+{
+	auto &entry = m_model.vec[f.idx];
+	QFileInfo info (entry.path ());
+	bool have = entry.images != nullptr && !entry.images->on_disk.isNull () && entry.mtime == info.lastModified ();
+	if (!have) {
+		/* If we have seen the contents before, load finds them in the cache.  */
+		QString hash = m_cache.known_hash (info, entry.file_id);
+		if (hash.isEmpty () || m_cache.find (hash) == nullptr) {
+			f.decoding = true;
+			auto runner = new slide_decode_runner (this, entry.path (), slide_decode_size (),
+							       [this] (const slide_decode &r) { slide_decoded (r); });
+			QThreadPool::globalInstance ()->start (runner);
+			return;
+		}
+		load (f.idx, false);
+	}
+	enqueue_render (f.idx);
+}
 
-	if (m_next_slide != -1)
-		switch_to (m_next_slide);
+bool MainWindow::slide_ready (const slide_frame &f)
+{
+	if (f.decoding)
+		return false;
+	const dir_entry &entry = m_model.vec[f.idx];
+	if (entry.images == nullptr || entry.images->on_disk.isNull ())
+		return false;
+	int scale_idx = ui->scaleComboBox->currentIndex ();
+	bool do_scale = scale_idx > 0 || m_free_scale != 1;
+	return find_render (entry, do_scale, size_for_image (entry, false)) != nullptr;
+}
 
-	int count = m_model.vec.size () - m_first_file_idx;
-	if (count > 1) {
-		for (int i = 0; i < 20; i++) {
-			int new_idx = m_first_file_idx + rand () % count;
-			if (!load (new_idx).isEmpty ()) {
-				enqueue_render (new_idx);
-				restart_render ();
-				m_next_slide = new_idx;
-				break;
-			}
+/* Keep the ready-ahead queue full, taking files from the shuffled order.  */
+void MainWindow::fill_slide_queue ()
+{
+	constexpr size_t ahead = 3;
+	int count = m_model.vec.size () - m_model.first_file;
+	if (count < 2)
+		return;
+	while (m_slide_ahead.size () < std::min<size_t> (ahead, count - 1)) {
+		if (m_slide_pos >= m_slide_order.size ()) {
+			m_slide_order.resize (count);
+			std::iota (m_slide_order.begin (), m_slide_order.end (), m_model.first_file);
+			std::shuffle (m_slide_order.begin (), m_slide_order.end (), m_slide_rng);
+			m_slide_pos = 0;
+			/* Don't show the same image twice in a row across shuffles.  */
+			if (m_slide_order[0] == m_idx)
+				std::swap (m_slide_order[0], m_slide_order[count - 1]);
 		}
+		int idx = m_slide_order[m_slide_pos++];
+		if (idx == m_idx || std::any_of (m_slide_ahead.begin (), m_slide_ahead.end (),
+						 [idx] (const slide_frame &f) { return f.idx == idx; }))
+			continue;
+		m_slide_ahead.emplace_back (idx);
+		prepare_slide (m_slide_ahead.back ());
 	}
+}
 
+void MainWindow::show_slide ()
+{
+	if (m_slide_late) {
+		qint64 late = m_slide_late_timer.elapsed ();
+		m_slide_stats.late_ms += late;
+		m_slide_stats.max_late_ms = std::max (m_slide_stats.max_late_ms, late);
+		m_slide_late = false;
+	}
+	m_slide_stats.shown++;
+	int idx = m_slide_ahead.front ().idx;
+	m_slide_ahead.pop_front ();
+	switch_to (idx);
+	fill_slide_queue ();
 	m_slide_timer.start (ui->slideTimeSpinBox->value ());
 }
 
+void MainWindow::slide_elapsed ()
+{
+	if (!m_sliding)
+		return;
+
+	fill_slide_queue ();
+	if (m_slide_ahead.empty ())
+		return;
+	if (slide_ready (m_slide_ahead.front ())) {
+		/* Let the frames get bigger again once we keep up.  */
+		if (++m_slide_on_time_run >= 10 && m_slide_quality < 1) {
+			m_slide_quality = std::min (1.0, m_slide_quality * 1.25);
+			m_slide_on_time_run = 0;
+		}
+		show_slide ();
+		return;
+	}
+	/* Missed the deadline.  Decode smaller images from now on, and show this
+	   one once the renderer is done with it.  */
+	m_slide_stats.late++;
+	m_slide_on_time_run = 0;
+	m_slide_quality = std::max (0.5, m_slide_quality * 0.8);
+	m_slide_late = true;
+	m_slide_late_timer.start ();
+	/* Make sure it gets rendered at the current size.  */
+	if (!m_slide_ahead.front ().decoding)
+		enqueue_render (m_slide_ahead.front ().idx);
+}
+
 void MainWindow::start_slideshow (bool)
 {
 	setWindowState (Qt::WindowFullScreen);
 	m_sliding = true;
-	srand (time (nullptr));
-	slide_elapsed ();
+	m_slide_order.clear ();
+	m_slide_pos = 0;
+	m_slide_quality = 1;
+	m_slide_on_time_run = 0;
+	m_slide_late = false;
+	m_slide_stats = {};
+	fill_slide_queue ();
+	m_slide_timer.start (ui->slideTimeSpinBox->value ());
 }
 
 void MainWindow::stop (bool)
 {
+	if (m_sliding && m_slide_stats.shown + m_slide_stats.late > 0)
+		fprintf (stderr, "slideshow: %d frames shown, %d late (%lld ms average, %lld ms worst)\n",
+			 m_slide_stats.shown, m_slide_stats.late,
+			 m_slide_stats.late > 0 ? m_slide_stats.late_ms / m_slide_stats.late : 0LL,
+			 m_slide_stats.max_late_ms);
 	m_sliding = false;
+	m_slide_late = false;
+	m_slide_ahead.clear ();
 	setWindowState (Qt::WindowNoState);
 	m_slide_timer.stop ();
+	/* The slide may have been decoded at a reduced size.  */
+	if (m_idx != -1) {
+		load (m_idx);
+		rescale_current ();
+	}
 }
 
 void MainWindow::perform_resizes ()
@@ -1100,7 +1462,54 @@ void MainWindow::update_adjustments ()
 	entry.tweaks.cspace_idx = ui->cspaceComboBox->currentIndex ();
 
 	send_tweaks_to_db (entry);
-	enqueue_render (m_idx, true);
+	rerender_current ();
+}
+
+namespace {
+
+/* Measure an image for auto-black on a worker thread.  */
+class stats_runner : public QRunnable
+{
+	MainWindow *m_win;
+	QPixmap m_src;
+	int m_cspace_idx;
+	std::function<void (const linear_stats &)> m_done;
+
+public:
+	stats_runner (MainWindow *win, const QPixmap &src, int cspace_idx,
+		      std::function<void (const linear_stats &)> done)
+		: m_win (win), m_src (src), m_cspace_idx (cspace_idx), m_done (std::move (done))
+	{
+		setAutoDelete (true);
+	}
+	void run () override
+	{
+		trace_span span ("stats");
+		linear_stats st = measure_linear (linear_image (m_src.toImage (), m_cspace_idx));
+		auto done = m_done;
+		QMetaObject::invokeMethod (m_win, [done, st] () { done (st); }, Qt::QueuedConnection);
+	}
+};
+
+}
+
+/* Store ST, measured for CSPACE_IDX, with the latest render of IMAGES if it
+   lacks them, so that they need not be measured again.  */
+static void keep_stats (img &images, int cspace_idx, const linear_stats &st)
+{
+	std::shared_ptr<const render_result> r = images.rendered ();
+	if (!r || r->have_stats || r->tweaks.cspace_idx != cspace_idx)
+		return;
+	auto with_stats = std::make_shared<render_result> (*r);
+	with_stats->l_maxr = st.maxr;
+	with_stats->l_maxg = st.maxg;
+	with_stats->l_maxb = st.maxb;
+	with_stats->l_minr = st.minr;
+	with_stats->l_ming = st.ming;
+	with_stats->l_minb = st.minb;
+	with_stats->l_minavg = st.minavg;
+	with_stats->have_stats = true;
+	images.replace_render (r, std::move (with_stats));
 }
 
 void MainWindow::do_autoblack (bool)
@@ -1108,19 +1517,43 @@ void MainWindow::do_autoblack (bool)
 	if (m_idx == -1)
 		return;
 
-	Renderer *r = m_renderer;
-	/* Ensure the current job is complete so that we have the necessary data.  */
-	r->completion_sem.acquire ();
-	r->completion_sem.release ();
-
 	auto &entry = m_model.vec[m_idx];
 	if (entry.images.get () == nullptr || entry.images->on_disk.isNull ())
 		return;
-	// printf ("min %d %d %d %d\n", entry.images->l_minr, entry.images->l_ming, entry.images->l_minb, entry.images->l_minavg);
+	for (auto &r: *entry.images->renders ())
+		if (r->have_stats && r->tweaks.cspace_idx == entry.tweaks.cspace_idx) {
+			linear_stats st;
+			st.minr = r->l_minr;
+			st.ming = r->l_ming;
+			st.minb = r->l_minb;
+			st.minavg = r->l_minavg;
+			autoblack_measured (entry.images, st);
+			return;
+		}
+	/* Untweaked images are displayed without ever computing statistics, so
+	   measure them now, without holding up the GUI.  */
+	std::shared_ptr<img> images = entry.images;
+	int cspace_idx = entry.tweaks.cspace_idx;
+	auto runner = new stats_runner (this, images->on_disk, cspace_idx,
+					[this, images, cspace_idx] (const linear_stats &st)
+					{
+						keep_stats (*images, cspace_idx, st);
+						autoblack_measured (images, st);
+					});
+	QThreadPool::globalInstance ()->start (runner);
+}
+
+/* Finish auto-black once the statistics of IMAGES are known, if they are
+   still what is shown.  */
+void MainWindow::autoblack_measured (const std::shared_ptr<img> &images, const linear_stats &st)
+{
+	if (m_idx == -1 || m_model.vec[m_idx].images != images)
+		return;
+	// printf ("min %d %d %d %d\n", st.minr, st.ming, st.minb, st.minavg);
 #if 0
-	ui->blackSlider->setValue (std::min ({ entry.images->l_minr, entry.images->l_ming, entry.images->l_minb }) / 256);
+	ui->blackSlider->setValue (std::min ({ st.minr, st.ming, st.minb }) / 256);
 #else
-	ui->blackSlider->setValue (entry.images->l_minavg / 256);
+	ui->blackSlider->setValue (st.minavg / 256);
 #endif
 }
 
@@ -1171,7 +1604,7 @@ void MainWindow::do_paste (const img_tweaks &source)
 	update_tweaks_ui (entry);
 	if (changed) {
 		send_tweaks_to_db (entry);
-		enqueue_render (m_idx, true);
+		rerender_current ();
 	}
 }
 
@@ -1188,7 +1621,7 @@ void MainWindow::clear_wb (bool)
 	update_wbcol_button (Qt::white);
 	entry.tweaks.white = Qt::white;
 	send_tweaks_to_db (entry);
-	enqueue_render (m_idx, true);
+	rerender_current ();
 }
 
 void MainWindow::choose_wb_color (bool)
@@ -1209,12 +1642,12 @@ void MainWindow::choose_wb_color (bool)
 		 [this, &entry] (QColor c)
 		 {
 			 entry.tweaks.white = srgb_to_linear (c);
-			 enqueue_render (m_idx, true);
+			 enqueue_render (m_idx);
 			 restart_render ();
 		 });
 	if (!dlg.exec ()) {
 		entry.tweaks.white = oldc;
-		enqueue_render (m_idx, true);
+		enqueue_render (m_idx);
 		restart_render ();
 	} else {
 		update_wbcol_button (entry.tweaks.white);
@@ -1238,7 +1671,7 @@ void MainWindow::clear_black (bool)
 		ui->blackSlider->setValue (0);
 	}
 	send_tweaks_to_db (entry);
-	enqueue_render (m_idx, true);
+	rerender_current ();
 }
 
 void MainWindow::clear_brightness (bool)
@@ -1257,7 +1690,7 @@ void MainWindow::clear_brightness (bool)
 		ui->brightSlider->setValue (0);
 	}
 	send_tweaks_to_db (entry);
-	enqueue_render (m_idx, true);
+	rerender_current ();
 }
 
 void MainWindow::clear_gamma (bool)
@@ -1276,7 +1709,7 @@ void MainWindow::clear_gamma (bool)
 		ui->gammaSlider->setValue (0);
 	}
 	send_tweaks_to_db (entry);
-	enqueue_render (m_idx, true);
+	rerender_current ();
 }
 
 void MainWindow::clear_sat (bool)
@@ -1295,7 +1728,7 @@ void MainWindow::clear_sat (bool)
 		ui->satSlider->setValue (0);
 	}
 	send_tweaks_to_db (entry);
-	enqueue_render (m_idx, true);
+	rerender_current ();
 }
 
 void MainWindow::clear_cspace (bool)
@@ -1314,7 +1747,7 @@ void MainWindow::clear_cspace (bool)
 		ui->cspaceComboBox->setCurrentIndex (0);
 	}
 	send_tweaks_to_db (entry);
-	enqueue_render (m_idx, true);
+	rerender_current ();
 }
 
 void MainWindow::keyPressEvent (QKeyEvent *e)
@@ -1357,6 +1790,59 @@ void MainWindow::restore_geometry ()
 		ui->action_ShowMenubar->setChecked (settings.value("mainwin/showmenu").toBool ());
 }
 
+void MainWindow::start_nav_timing ()
+{
+	m_nav_timer.start ();
+	m_nav_first_pending = m_nav_final_pending = true;
+}
+
+/* Nearest-rank percentile P of the sorted values in V.  */
+static double percentile (const std::vector<double> &v, double p)
+{
+	size_t rank = std::ceil (p / 100 * v.size ());
+	return v[std::clamp<size_t> (rank, 1, v.size ()) - 1];
+}
+
+static QString latency_summary (std::vector<double> v)
+{
+	if (v.empty ())
+		return "-";
+	std::sort (v.begin (), v.end ());
+	return QString ("p50 %1 p95 %2 p99 %3 ms").arg (percentile (v, 50), 0, 'f', 1)
+		.arg (percentile (v, 95), 0, 'f', 1).arg (percentile (v, 99), 0, 'f', 1);
+}
+
+void MainWindow::update_hud ()
+{
+	auto last = [] (const std::vector<double> &v) { return v.empty () ? QString ("-") : QString::number (v.back (), 'f', 1); };
+	int lookups = m_cache.hits () + m_cache.misses ();
+	pool_stats pool = buffer_pool_stats ();
+	QString text = tr ("first image: %1 ms (%2)\n"
+			   "final image: %3 ms (%4)\n"
+			   "render queue: %5%6\n"
+			   "cache hits: %7%\n"
+			   "image memory: %8 of %9 MB\n"
+			   "buffer pool: %10 MB in use, %11 MB free, %12% reused")
+		.arg (last (m_nav_first_ms), latency_summary (m_nav_first_ms))
+		.arg (last (m_nav_final_ms), latency_summary (m_nav_final_ms))
+		.arg (m_queue.size ()).arg (m_render_queued ? tr (" + 1 rendering") : QString ())
+		.arg (lookups > 0 ? 100 * m_cache.hits () / lookups : 0)
+		.arg (m_cache.bytes () / (1024 * 1024)).arg (m_cache_budget / (1024 * 1024))
+		.arg (pool.bytes_used / (1024 * 1024)).arg (pool.bytes_free / (1024 * 1024))
+		.arg (pool.hits + pool.misses > 0 ? 100 * pool.hits / (pool.hits + pool.misses) : 0);
+	m_hud->setText (text);
+	m_hud->adjustSize ();
+}
+
+void MainWindow::print_latencies ()
+{
+	if (m_nav_first_ms.empty ())
+		return;
+	fprintf (stderr, "latency over %d image changes: first image %s, final image %s\n", (int)m_nav_first_ms.size (),
+		 latency_summary (m_nav_first_ms).toLocal8Bit ().constData (),
+		 latency_summary (m_nav_final_ms).toLocal8Bit ().constData ());
+}
+
 void MainWindow::closeEvent (QCloseEvent *event)
 {
 	setWindowState (Qt::WindowNoState);
@@ -1364,6 +1850,7 @@ void MainWindow::closeEvent (QCloseEvent *event)
 	m_resize_timer.stop ();
 	m_db_timer.stop ();
 	sync_to_db ();
+	print_latencies ();
 
 	QSettings settings;
 	settings.setValue ("mainwin/geometry", saveGeometry ());
@@ -1388,6 +1875,9 @@ void MainWindow::perform_setup ()
 	m_resize_timer.setSingleShot (true);
 	connect (&m_resize_timer, &QTimer::timeout, this, &MainWindow::perform_resizes);
 
+	/* A directory scan may already have shown something.  */
+	if (m_idx != -1)
+		return;
 	for (int i = 0; i < m_model.vec.size (); i++)
 		if (!m_model.vec[i].isdir) {
 			switch_to (i);
@@ -1395,8 +1885,8 @@ void MainWindow::perform_setup ()
 		}
 }
 
-MainWindow::MainWindow (const QStringList &files)
-	: ui (new Ui::MainWindow), m_db (QSqlDatabase::database (PACKAGE))
+MainWindow::MainWindow (const QStringList &files, bool recursive)
+	: ui (new Ui::MainWindow), m_db (QSqlDatabase::database (PACKAGE)), m_recursive (recursive)
 {
 	ui->setupUi (this);
 	ui->imageView->setScene (&m_canvas);
@@ -1404,13 +1894,29 @@ MainWindow::MainWindow (const QStringList &files)
 	ui->action_ShowMenubar->setChecked (true);
 	ui->action_Rename->setEnabled (false);
 	ui->action_Delete->setEnabled (false);
+	ui->action_Export->setEnabled (false);
 
 	restore_geometry ();
 
 	menuBar ()->setVisible (ui->action_ShowMenubar->isChecked ());
 	statusBar ()->hide ();
+
+	QSettings settings;
+	if (settings.contains ("cache/megabytes"))
+		m_cache_budget = settings.value ("cache/megabytes").toLongLong () * 1024 * 1024;
+	/* Unused render buffers come on top of the cache, so keep them to a
+	   fraction of it.  */
+	pool_set_limit (m_cache_budget / 4);
+
 	start_threads ();
 
+	m_watcher = new DirWatcher (this);
+	connect (m_watcher, &DirWatcher::signal_created, this, &MainWindow::fs_created);
+	connect (m_watcher, &DirWatcher::signal_removed, this, &MainWindow::fs_removed);
+	connect (m_watcher, &DirWatcher::signal_renamed, this, &MainWindow::fs_renamed);
+	connect (m_watcher, &DirWatcher::signal_modified, this, &MainWindow::fs_modified);
+	connect (m_watcher, &DirWatcher::signal_overflow, [this] () { slot_rescan (); });
+
 	if (files.size () <= 1) {
 		QString f (files.empty () ? "." : files[0]);
 		QFileInfo fi (f);
@@ -1429,6 +1935,33 @@ MainWindow::MainWindow (const QStringList &files)
 	ui->linksWidget->hide ();
 
 	ui->fileView->setModel (&m_model);
+	connect (&m_model, &QAbstractItemModel::rowsInserted,
+		 [this] (const QModelIndex &, int first, int last)
+		 {
+			 int n = last - first + 1;
+			 remap_indices ([=] (int i) { return i >= first ? i + n : i; });
+		 });
+	connect (&m_model, &QAbstractItemModel::rowsRemoved,
+		 [this] (const QModelIndex &, int first, int last)
+		 {
+			 int n = last - first + 1;
+			 remap_indices ([=] (int i) { return i > last ? i - n : i >= first ? -1 : i; });
+		 });
+	connect (&m_model, &QAbstractItemModel::rowsMoved,
+		 [this] (const QModelIndex &, int first, int last, const QModelIndex &, int dest)
+		 {
+			 int n = last - first + 1;
+			 remap_indices ([=] (int i)
+					{
+						if (i >= first && i <= last)
+							return (dest > last ? dest - n : dest) + i - first;
+						if (dest > last && i > last && i < dest)
+							return i - n;
+						if (dest < first && i >= dest && i < first)
+							return i + n;
+						return i;
+					});
+		 });
 	connect (ui->fileView->selectionModel (), &QItemSelectionModel::selectionChanged,
 		 [this] (const QItemSelection &, const QItemSelection &) { update_selection (); });
 	connect (ui->fileView, &ClickableListView::doubleclicked, this, &MainWindow::files_doubleclick);
@@ -1440,6 +1973,28 @@ MainWindow::MainWindow (const QStringList &files)
 	m_slide_timer.setSingleShot (true);
 	connect (&m_slide_timer, &QTimer::timeout, this, &MainWindow::slide_elapsed);
 
+	m_hud = new QLabel (ui->imageView);
+	m_hud->setStyleSheet ("QLabel { background-color: rgba(0, 0, 0, 160); color: white; padding: 4px; }");
+	m_hud->setFont (QFontDatabase::systemFont (QFontDatabase::FixedFont));
+	m_hud->setAttribute (Qt::WA_TransparentForMouseEvents);
+	m_hud->move (8, 8);
+	m_hud->hide ();
+	m_hud_timer.setInterval (500);
+	connect (&m_hud_timer, &QTimer::timeout, this, &MainWindow::update_hud);
+	connect (ui->action_PerfOverlay, &QAction::toggled, [this] (bool on)
+		 {
+			 m_hud->setVisible (on);
+			 if (on) {
+				 update_hud ();
+				 m_hud_timer.start ();
+			 } else
+				 m_hud_timer.stop ();
+		 });
+
+	m_fetch_timer.setSingleShot (true);
+	m_fetch_timer.setInterval (100);
+	connect (&m_fetch_timer, &QTimer::timeout, this, &MainWindow::fetch_entries);
+
 	m_db_timer.setInterval (3000);
 	connect (&m_db_timer, &QTimer::timeout, this, &MainWindow::sync_to_db);
 
@@ -1449,7 +2004,11 @@ MainWindow::MainWindow (const QStringList &files)
 	connect (ui->imageView, &SizeGraphicsView::wheel_event, this, &MainWindow::image_wheel_event);
 
 	ui->action_Rescan->setEnabled (!m_individual_files);
+	ui->action_Recursive->setEnabled (!m_individual_files);
+	ui->action_Recursive->setChecked (m_recursive);
 	connect (ui->action_Rescan, &QAction::triggered, this, &MainWindow::slot_rescan);
+	connect (ui->action_Recursive, &QAction::toggled, [this] (bool v) { m_recursive = v; slot_rescan (); });
+	connect (ui->action_Export, &QAction::triggered, this, &MainWindow::slot_save_as);
 	connect (ui->action_Rename, &QAction::triggered, this, &MainWindow::slot_rename);
 	connect (ui->action_Delete, &QAction::triggered, this, &MainWindow::slot_delete);
 
@@ -1529,9 +2088,9 @@ MainWindow::MainWindow (const QStringList &files)
 	fa->setShortcut(Qt::Key_F);
 	ta->setShortcut(Qt::Key_T);
 
-	addActions ({ ui->action_Quit, ui->action_Rename, ui->action_Delete, ui->action_Rescan });
+	addActions ({ ui->action_Quit, ui->action_Export, ui->action_Rename, ui->action_Delete, ui->action_Rescan, ui->action_Recursive });
 	addActions ({ fa, ta });
-	addActions ({ ui->action_ShowMenubar });
+	addActions ({ ui->action_ShowMenubar, ui->action_PerfOverlay });
 	addActions ({ ui->action_Scale, ui->action_ZReset });
 	addActions ({ ui->action_Copy, ui->action_Paste });
 	addActions ({ ui->action_RCW, ui->action_RCCW, ui->action_MH, ui->action_FV, ui->action_DSize, ui->action_HSize });
@@ -1543,20 +2102,62 @@ MainWindow::~MainWindow ()
 	delete ui;
 }
 
+/* The export mode must work without a display, so look for it before the
+   application object is created.  */
+static bool want_headless (int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++)
+		if (strcmp (argv[i], "--export") == 0 || strncmp (argv[i], "--export=", 9) == 0)
+			return true;
+	return false;
+}
+
 int main (int argc, char **argv)
 {
-	QApplication::setAttribute (Qt::AA_EnableHighDpiScaling);
-	QApplication myapp (argc, argv);
+	bool headless = want_headless (argc, argv);
+	std::unique_ptr<QCoreApplication> myapp;
+	if (headless)
+		myapp = std::make_unique<QCoreApplication> (argc, argv);
+	else {
+		QApplication::setAttribute (Qt::AA_EnableHighDpiScaling);
+		myapp = std::make_unique<QApplication> (argc, argv);
+	}
 
-	myapp.setOrganizationName ("bernds");
-	myapp.setApplicationName (PACKAGE);
+	myapp->setOrganizationName ("bernds");
+	myapp->setApplicationName (PACKAGE);
 
 	QCommandLineParser cmdp;
 
 	cmdp.addHelpOption ();
+	QCommandLineOption recursive_option ({ "r", "recursive" }, QObject::tr ("Show all images below the directory as one list."));
+	cmdp.addOption (recursive_option);
+	QCommandLineOption export_option ("export", QObject::tr ("Write the images given on the command line to <dir> with their edits applied, without opening a window."),
+					  QObject::tr ("dir"));
+	cmdp.addOption (export_option);
+	QCommandLineOption format_option ("format", QObject::tr ("Output format for --export: png, jpeg or tiff (16 bits per channel)."),
+					  QObject::tr ("format"), "png");
+	cmdp.addOption (format_option);
+	QCommandLineOption quality_option ("quality", QObject::tr ("JPEG quality for --export."), QObject::tr ("n"), "92");
+	cmdp.addOption (quality_option);
+	QCommandLineOption jobs_option ("jobs", QObject::tr ("Number of images to export at the same time."), QObject::tr ("n"), "0");
+	cmdp.addOption (jobs_option);
+	QCommandLineOption memory_option ("memory", QObject::tr ("Memory the images exported at the same time may use between them, in megabytes."), QObject::tr ("n"), "4096");
+	cmdp.addOption (memory_option);
+	QCommandLineOption trace_option ("trace", QObject::tr ("Record the time spent in each stage of loading and rendering, and write it to <file> as Chrome trace JSON on exit.  The EQUIV_TRACE environment variable does the same."),
+					 QObject::tr ("file"));
+	cmdp.addOption (trace_option);
+	QCommandLineOption reference_option ("reference", QObject::tr ("Use the reference versions of the colour pipeline instead of the optimised ones.  The EQUIV_REFERENCE environment variable does the same."));
+	cmdp.addOption (reference_option);
 	cmdp.addPositionalArgument ("path", QObject::tr ("Oepn <path> as a file or directory."));
 
-	cmdp.process (myapp);
+	cmdp.process (*myapp);
+
+	if (cmdp.isSet (reference_option) || !qEnvironmentVariableIsEmpty ("EQUIV_REFERENCE"))
+		use_reference_pipeline = true;
+	if (cmdp.isSet (trace_option))
+		trace_start (cmdp.value (trace_option));
+	else if (!qEnvironmentVariableIsEmpty ("EQUIV_TRACE"))
+		trace_start (qEnvironmentVariable ("EQUIV_TRACE"));
 
         QStringList imgdirs = QStandardPaths::standardLocations (QStandardPaths::PicturesLocation);
 	if (imgdirs.isEmpty ()) {
@@ -1575,8 +2176,32 @@ int main (int argc, char **argv)
 	QSettings settings;
 
 	const QStringList args = cmdp.positionalArguments ();
-	auto w = new MainWindow (args);
+	if (headless) {
+		export_options opts;
+		opts.outdir = cmdp.value (export_option);
+		opts.format = cmdp.value (format_option).toLower ().toLatin1 ();
+		if (opts.format == "jpg")
+			opts.format = "jpeg";
+		else if (opts.format == "tif")
+			opts.format = "tiff";
+		opts.quality = cmdp.value (quality_option).toInt ();
+		opts.jobs = cmdp.value (jobs_option).toInt ();
+		opts.memory = std::max (1LL, cmdp.value (memory_option).toLongLong ()) * 1024 * 1024;
+		opts.recursive = cmdp.isSet (recursive_option);
+		if (args.isEmpty ()) {
+			fprintf (stderr, "error: no files or directories to export\n");
+			return 1;
+		}
+		int retval = run_export (args, opts);
+		trace_write ();
+		return retval;
+	}
+
+	auto w = new MainWindow (args, cmdp.isSet (recursive_option));
 	w->show ();
-	auto retval = myapp.exec ();
+	auto retval = myapp->exec ();
+	/* No other thread may record events while they are written.  */
+	w->stop_threads ();
+	trace_write ();
 	return retval;
 }
@@ -29,19 +29,14 @@ void RenameDialog::accept ()
 		QMessageBox::warning (this, PACKAGE, tr ("New name is empty."));
 		return;
 	}
-	QString cur = QDir::currentPath ();
-	if (!QDir::setCurrent (m_entry->dir.absolutePath ())) {
-		QMessageBox::warning (this, PACKAGE, tr ("The rename operation failed."));
-		return;
-	}
+	/* The new name is relative to the entry's directory, and may contain a path.  */
+	QString newpath = QDir::cleanPath (m_entry->dir.absoluteFilePath (newname));
 	QFile f (m_oldpath);
-	bool success = f.rename (newname);
-	QDir::setCurrent (cur);
-	if (!success) {
+	if (!f.rename (newpath)) {
 		QMessageBox::warning (this, PACKAGE, tr ("The rename operation failed."));
 		return;
 	}
-	QFileInfo info (f);
+	QFileInfo info (newpath);
 	m_entry->name = info.fileName ();
 	m_entry->dir = info.dir ();
 	QDialog::accept ();
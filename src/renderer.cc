@@ -8,6 +8,10 @@
 
 #include "mainwindow.h"
 #include "colors.h"
+#include "geometry.h"
+#include "resample.h"
+#include "pipeline.h"
+#include "trace.h"
 
 static inline uint32_t color_merge (uint32_t c1, uint32_t c2, double m1)
 {
@@ -51,155 +55,107 @@ void Renderer::do_render ()
 {
 }
 
-void Renderer::slot_render (int idx, int gen, img *e, img_tweaks *tw, int w, int h, bool tweaked)
+/* Render JOB, reusing what still fits from the renders kept for the image.
+   Returns null if the job is no longer wanted.  */
+std::shared_ptr<const render_result> Renderer::render (const render_job &job)
 {
-	// printf ("start render %d: %d x %d rot %d (was %d)\n", idx, w, h, tw->rot, e->render_rot);
-	mutex.lock ();
-	QPixmap pm = e->on_disk;
-	QImage linear = e->linear;
-	QPixmap corrected = e->corrected;
-	mutex.unlock ();
+	const img_tweaks &tw = job.tweaks;
+	/* Checked between the stages, so that a render for a model that has gone
+	   away does not hold up the next one for long.  */
+	auto cancelled = [&] () { return abort_render || job.gen != wanted_gen; };
+	if (cancelled ())
+		return nullptr;
 
-	if (!abort_render) {
-		if (linear.isNull () || e->linear_cspace_idx != tw->cspace_idx) {
-			linear = pm.toImage ().convertToFormat (QImage::Format_RGBA64);
-			if (tw->cspace_idx != 0)
-				linear.setColorSpace ((QColorSpace::NamedColorSpace)tw->cspace_idx);
-			else if (!linear.colorSpace ().isValid ())
-				linear.setColorSpace (QColorSpace::SRgb);
-			QColorSpace linear_cs = linear.colorSpace ();
-			linear_cs.setTransferFunction (QColorSpace::TransferFunction::Linear);
-			linear.convertToColorSpace (linear_cs);
-			auto bits1 = linear.bits ();
-			uint64_t *bits = (uint64_t *)bits1;
-			QSize sz = linear.size ();
-			long count = (long)sz.width () * (long)sz.height ();
-			int maxr = 1, maxg = 1, maxb = 1;
-			int minr = 65535, ming = 65535, minb = 65535, mina = 65535;
-			for (long i = 0; i < count; i++) {
-				uint64_t v = *bits;
-				int b = v & 65535;
-				v >>= 16;
-				int g = v & 65535;
-				v >>= 16;
-				int r = v & 65535;
+	/* Switching back to tweaks, a colour space or a size seen recently is only
+	   a matter of making that render the current one again.  */
+	if (auto found = job.images->find_render (tw, true, job.size))
+		return found;
 
-				maxr = std::max (r, maxr);
-				maxg = std::max (g, maxg);
-				maxb = std::max (b, maxb);
-				minr = std::min (r, minr);
-				ming = std::min (g, ming);
-				minb = std::min (b, minb);
-				int avg = (r + b + g) / 3;
-				mina = std::min (avg, mina);
-				bits++;
-			}
-			// printf ("count %ld, max %d %d %d\n", count, maxr, maxg, maxb);
-			e->l_maxr = maxr;
-			e->l_maxg = maxg;
-			e->l_maxb = maxb;
-			e->l_minr = minr;
-			e->l_ming = ming;
-			e->l_minb = minb;
-			e->l_minavg = mina;
-		}
-
-		int wr = std::max (1, tw->white.red ());
-		int wg = std::max (1, tw->white.green ());
-		int wb = std::max (1, tw->white.blue ());
-		int wmax = std::max ({wr, wg, wb});
-		double fr = (double)wmax / wr;
-		double fg = (double)wmax / wg;
-		double fb = (double)wmax / wb;
-
-		double rlimit = 65535. / (e->l_maxr * fr);
-		double glimit = 65535. / (e->l_maxg * fg);
-		double blimit = 65535. / (e->l_maxb * fb);
-		double limit = std::min ({ 1.0, rlimit, glimit, blimit });
-		if (corrected.isNull () || e->render_tweaks != tweaked || e->render_rot != tw->rot || e->render_mirror != tw->mirrored) {
-			QImage tmp = linear;
-			double gammaval = 1 + tw->gamma / 100.1;
-			double satval = -tw->sat / 100.;
-			double bright = 1 + tw->brightness / 100.;
-
-			if (tw->blacklevel != 0 || tw->brightness != 0 || tw->sat != 0 || tw->gamma != 0 || tw->white != Qt::white) {
-				auto bits1 = tmp.bits ();
-				uint64_t *bits = (uint64_t *)bits1;
-				QSize sz = tmp.size ();
-				long count = (long)sz.width () * (long)sz.height ();
-				uint64_t black = tw->blacklevel * 256;
-				float scale = bright * 65536. / (65536. - black);
-				// printf ("black %d max %d %d %d scales: %f %f %f limit: %f\n", (int)black, e->l_maxr, e->l_maxg, e->l_maxb, fr, fg, fb, limit);
-				scale *= limit;
-				black *= scale;
-				for (long i = 0; i < count; i++) {
-					uint64_t v = *bits;
-					int r = v & 65535;
-					v >>= 16;
-					int g = v & 65535;
-					v >>= 16;
-					int b = v & 65535;
-					v >>= 16;
-					r = std::clamp ((int)(r * fr * scale - black), 0, 65535);
-					g = std::clamp ((int)(g * fg * scale - black), 0, 65535);
-					b = std::clamp ((int)(b * fb * scale - black), 0, 65535);
+	/* Otherwise reuse the most recent render that has the right colours,
+	   preferably also the right geometry, or at least the right linear
+	   image.  */
+	std::shared_ptr<const render_set> renders = job.images->renders ();
+	std::shared_ptr<const render_result> prev, prev_linear;
+	for (auto &r: *renders) {
+		if (r->tweaks.same_colours (tw) && !r->corrected_src.isNull ()
+		    && (!prev || (r->matches (tw, false, QSize ()) && !prev->matches (tw, false, QSize ()))))
+			prev = r;
+		if (!prev_linear && !r->linear.is_null () && r->tweaks.cspace_idx == tw.cspace_idx)
+			prev_linear = r;
+	}
 
-					if (satval != 0) {
-						int lumi = r * l_factor_r + g * l_factor_g + b * l_factor_b;
-						r = std::clamp ((int)(r + satval * (lumi - r)), 0, 65535);
-						g = std::clamp ((int)(g + satval * (lumi - g)), 0, 65535);
-						b = std::clamp ((int)(b + satval * (lumi - b)), 0, 65535);
-					}
-					if (gammaval != 1) {
-						r = pow (r / 65535., gammaval) * 65535;
-						g = pow (g / 65535., gammaval) * 65535;
-						b = pow (b / 65535., gammaval) * 65535;
-					}
-					v <<= 32;
-					v |= b << 16;
-					v |= g;
-					v <<= 16;
-					v |= r;
-					*bits++ = v;
-				}
-			}
-#if 0 /* Doesn't seem to work??? */
-			if (tw->gamma != 0) {
-				QColorSpace gammacs = linear.colorSpace ().withTransferFunction (QColorSpace::TransferFunction::Gamma,
-												 1 + tw->gamma / 100.1);
-				tmp.convertToColorSpace (gammacs);
-//				tmp.setColorSpace (QColorSpace::SRgbLinear);
+	auto res = std::make_shared<render_result> ();
+	res->tweaks = tw;
+	if (prev) {
+		*res = *prev;
+		res->tweaks = tw;
+		res->scaled = QPixmap ();
+		if (prev->tweaks.rot != tw.rot || prev->tweaks.mirrored != tw.mirrored)
+			res->corrected = QPixmap ();
+	} else {
+		res->corrected_src = untweaked_image (job.source.toImage (), tw);
+		/* Without colour tweaks, nothing needs the linear image or its
+		   statistics until the tweaks change.  */
+		if (res->corrected_src.isNull ()) {
+			linear_stats st;
+			if (prev_linear) {
+				res->linear = prev_linear->linear;
+				st.maxr = res->l_maxr = prev_linear->l_maxr;
+				st.maxg = res->l_maxg = prev_linear->l_maxg;
+				st.maxb = res->l_maxb = prev_linear->l_maxb;
+				res->l_minr = prev_linear->l_minr;
+				res->l_ming = prev_linear->l_ming;
+				res->l_minb = prev_linear->l_minb;
+				res->l_minavg = prev_linear->l_minavg;
+			} else {
+				trace_span lin_span ("linearize", job.idx);
+				res->linear = linear_image (job.source.toImage (), tw.cspace_idx);
+				lin_span.end ();
+				trace_span stats_span ("stats", job.idx);
+				st = measure_linear (res->linear);
+				res->l_maxr = st.maxr;
+				res->l_maxg = st.maxg;
+				res->l_maxb = st.maxb;
+				res->l_minr = st.minr;
+				res->l_ming = st.ming;
+				res->l_minb = st.minb;
+				res->l_minavg = st.minavg;
 			}
-#endif
-			tmp.convertToColorSpace (QColorSpace::SRgb);
-			QTransform t;
-			if (tw->rot != 0)
-				t.rotate (tw->rot);
-			if (tw->mirrored) {
-				t.scale(-1, 1);
-			}
-			if (tw->rot != 0 || tw->mirrored)
-				tmp = tmp.transformed (t);
-			corrected = QPixmap::fromImage (tmp.convertToFormat (QImage::Format_ARGB32));
+			res->have_stats = true;
+			if (cancelled ())
+				return nullptr;
+			trace_span tweak_span ("tweak", job.idx);
+			res->corrected_src = apply_tweaks (res->linear, tw, st).convertToFormat (QImage::Format_ARGB32);
 		}
-		QSize ts (corrected.width (), corrected.height ());
-		ts.scale (w, h, Qt::KeepAspectRatio);
-		// Scale to exactly w and h: these were calculated with the right aspect ratio.
-		// If we use KeepAspectRatio here, Qt can produce a new size that differs by one
-		// pixel in one of the dimensions, causing us to not use the scaled image.
-		QPixmap scaled = corrected.scaled (w, h, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
-		// printf ("scaling: %dx%d vs %dx%d\n", scaled.width (), scaled.height (), ts.width (), ts.height ());
-		QMutexLocker lock (&mutex);
-		e->linear = linear;
-		e->corrected = corrected;
-		e->scaled = scaled;
-		e->render_rot = tw->rot;
-		e->render_mirror = tw->mirrored;
-		e->linear_cspace_idx = tw->cspace_idx;
-		e->render_tweaks = tweaked;
 	}
-	completion_sem.release ();
-	// printf ("end render %d\n", idx);
-	emit signal_render_complete (idx, gen);
+	if (cancelled ())
+		return nullptr;
+	/* Geometry is applied last, so that rotating or mirroring never needs
+	   to rerun the colour pipeline above.  */
+	if (res->corrected.isNull ()) {
+		trace_span rot_span ("rotate_pixmap", job.idx);
+		res->corrected = QPixmap::fromImage (rotate_image (res->corrected_src, tw.rot, tw.mirrored));
+	}
+	// Scale to exactly the size given: it was calculated with the right aspect ratio.
+	// If we use KeepAspectRatio here, Qt can produce a new size that differs by one
+	// pixel in one of the dimensions, causing us to not use the scaled image.
+	// Scaling happens in the source orientation, which makes the rotation
+	// afterwards cheap.
+	QSize src_sz = rotated_size (job.size, tw.rot);
+	trace_span scale_span ("scale", job.idx);
+	QImage scaled_src = resample_image (res->corrected_src, src_sz);
+	res->scaled = QPixmap::fromImage (rotate_image (scaled_src, tw.rot, tw.mirrored));
+	return res;
 }
 
+void Renderer::slot_render (render_job job)
+{
+	// printf ("start render %d: %d x %d rot %d\n", job.idx, job.size.width (), job.size.height (), job.tweaks.rot);
+	trace_span span ("render", job.idx);
+	std::shared_ptr<const render_result> res = render (job);
+	if (res)
+		job.images->publish (std::move (res));
+	completion_sem.release ();
+	// printf ("end render %d\n", job.idx);
+	emit signal_render_complete (job.idx, job.gen);
+}
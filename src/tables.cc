@@ -1,15 +1,105 @@
 /*
  *   tables.cpp = part of mainwindow
  */
+#include <algorithm>
+
 #include "imgentry.h"
 
 void simple_fs_model::reset ()
 {
 	beginResetModel ();
 	vec.clear ();
+	m_pending.clear ();
+	first_file = 0;
 	endResetModel ();
 }
 
+/* Queue entries found by a directory scan.  They become visible with the next
+   call to fetchMore.  */
+void simple_fs_model::add_pending (const QDir &dir, const QStringList &dirs, const QStringList &files,
+				   const QStringList &ids)
+{
+	for (auto &n: dirs)
+		m_pending.emplace_back (dir, n, true);
+	for (int i = 0; i < files.size (); i++) {
+		m_pending.emplace_back (dir, files[i], false);
+		m_pending.back ().file_id = ids.value (i);
+	}
+}
+
+bool simple_fs_model::canFetchMore (const QModelIndex &parent) const
+{
+	return !parent.isValid () && !m_pending.empty ();
+}
+
+/* Add all pending entries.  Directories go to the end of the directory block,
+   files to the end of the list, so that each is a single contiguous insertion.  */
+void simple_fs_model::fetchMore (const QModelIndex &parent)
+{
+	if (parent.isValid () || m_pending.empty ())
+		return;
+
+	auto dirs_end = std::stable_partition (m_pending.begin (), m_pending.end (),
+					       [] (const dir_entry &e) { return e.isdir; });
+	int ndirs = dirs_end - m_pending.begin ();
+	int nfiles = m_pending.size () - ndirs;
+	if (ndirs > 0) {
+		beginInsertRows (QModelIndex (), first_file, first_file + ndirs - 1);
+		vec.insert (vec.begin () + first_file,
+			    std::make_move_iterator (m_pending.begin ()), std::make_move_iterator (dirs_end));
+		first_file += ndirs;
+		endInsertRows ();
+	}
+	if (nfiles > 0) {
+		int old_size = vec.size ();
+		beginInsertRows (QModelIndex (), old_size, old_size + nfiles - 1);
+		vec.insert (vec.end (), std::make_move_iterator (dirs_end), std::make_move_iterator (m_pending.end ()));
+		endInsertRows ();
+	}
+	m_pending.clear ();
+}
+
+/* Put the entries in their final order: directories first, then files, each
+   sorted by name.  Returns the new row for every old row.  */
+std::vector<int> simple_fs_model::sort ()
+{
+	emit layoutAboutToBeChanged ();
+
+	std::vector<int> order (vec.size ());
+	for (size_t i = 0; i < order.size (); i++)
+		order[i] = i;
+	std::stable_sort (order.begin (), order.end (),
+			  [this] (int a, int b)
+			  {
+				  const dir_entry &ea = vec[a];
+				  const dir_entry &eb = vec[b];
+				  if (ea.isdir != eb.isdir)
+					  return ea.isdir;
+				  return ea.name < eb.name;
+			  });
+
+	std::vector<int> new_row (vec.size ());
+	std::vector<dir_entry> sorted;
+	sorted.reserve (vec.size ());
+	first_file = 0;
+	for (size_t i = 0; i < order.size (); i++) {
+		new_row[order[i]] = i;
+		sorted.push_back (std::move (vec[order[i]]));
+		if (sorted.back ().isdir)
+			first_file++;
+	}
+	vec = std::move (sorted);
+
+	QModelIndexList from = persistentIndexList ();
+	QModelIndexList to;
+	for (auto &i: from)
+		to.append (index (new_row[i.row ()], i.column ()));
+	changePersistentIndexList (from, to);
+
+	emit layoutChanged ();
+	return new_row;
+}
+
 QVariant simple_fs_model::data (const QModelIndex &index, int role) const
 {
 	int row = index.row ();
@@ -30,6 +120,71 @@ QVariant simple_fs_model::data (const QModelIndex &index, int role) const
 	return e.name;
 }
 
+/* The following functions require the model to be sorted, i.e. no directory
+   scan may be in progress.  */
+
+static bool entry_less (const dir_entry &e, const QString &name)
+{
+	return e.name < name;
+}
+
+/* Return the row of the entry called NAME, or -1 if there is none.  */
+int simple_fs_model::find_entry (const QString &name, bool isdir) const
+{
+	auto first = vec.begin () + (isdir ? 0 : first_file);
+	auto last = isdir ? vec.begin () + first_file : vec.end ();
+	auto it = std::lower_bound (first, last, name, entry_less);
+	if (it == last || it->name != name)
+		return -1;
+	return it - vec.begin ();
+}
+
+/* Insert a new entry at its sorted position and return its row.  */
+int simple_fs_model::insert_entry (dir_entry &&e)
+{
+	auto first = vec.begin () + (e.isdir ? 0 : first_file);
+	auto last = e.isdir ? vec.begin () + first_file : vec.end ();
+	int row = std::lower_bound (first, last, e.name, entry_less) - vec.begin ();
+	beginInsertRows (QModelIndex (), row, row);
+	if (e.isdir)
+		first_file++;
+	vec.insert (vec.begin () + row, std::move (e));
+	endInsertRows ();
+	return row;
+}
+
+/* Give the entry at ROW a new name and move it to its sorted position.
+   Returns the new row.  */
+int simple_fs_model::rename_entry (int row, const QString &name)
+{
+	bool isdir = vec[row].isdir;
+	auto first = vec.begin () + (isdir ? 0 : first_file);
+	auto last = isdir ? vec.begin () + first_file : vec.end ();
+	/* The section is still sorted with the old name in place, so this gives the
+	   destination in terms of the current rows, as beginMoveRows wants it.  */
+	int dest = std::lower_bound (first, last, name, entry_less) - vec.begin ();
+	vec[row].name = name;
+	if (dest == row || dest == row + 1) {
+		entry_changed (row);
+		return row;
+	}
+	beginMoveRows (QModelIndex (), row, row, QModelIndex (), dest);
+	if (dest > row)
+		std::rotate (vec.begin () + row, vec.begin () + row + 1, vec.begin () + dest);
+	else
+		std::rotate (vec.begin () + dest, vec.begin () + row, vec.begin () + row + 1);
+	endMoveRows ();
+	int new_row = dest > row ? dest - 1 : dest;
+	entry_changed (new_row);
+	return new_row;
+}
+
+void simple_fs_model::entry_changed (int row)
+{
+	QModelIndex idx = index (row);
+	emit dataChanged (idx, idx);
+}
+
 const dir_entry *simple_fs_model::find (const QModelIndex &index) const
 {
 	int row = index.row ();
@@ -47,6 +202,9 @@ bool simple_fs_model::removeRows (int row, int count, const QModelIndex &parent)
 	if (row < 0 || count < 1 || (size_t) (row + count) > vec.size ())
 		return false;
 	beginRemoveRows (parent, row, row + count - 1);
+	for (int i = row; i < row + count; i++)
+		if (vec[i].isdir)
+			first_file--;
 	vec.erase (vec.begin () + row, vec.begin () + (row + count));
 	endRemoveRows ();
 	return true;
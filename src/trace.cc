@@ -0,0 +1,178 @@
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include <QString>
+#include <QFile>
+#include <QMutex>
+#include <QThread>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+
+#include "trace.h"
+
+std::atomic<bool> trace_enabled { false };
+
+namespace {
+
+struct trace_event
+{
+	const char *name;
+	uint64_t start, dur;
+	int arg;
+	bool instant;
+};
+
+/* Only the owning thread writes to a ring.  Once it is full, the oldest events
+   are overwritten.  */
+constexpr uint64_t ring_size = 1 << 16;
+
+struct trace_ring
+{
+	int tid;
+	/* The objectName of the owning thread, or empty.  */
+	QString key;
+	QString thread_name;
+	std::unique_ptr<trace_event[]> events { new trace_event[ring_size] };
+	std::atomic<uint64_t> count { 0 };
+	/* Cleared when the owning thread exits.  Protected by rings_mutex.  */
+	bool in_use = true;
+};
+
+QMutex rings_mutex;
+/* Rings live until the program exits, since their events are only written
+   then.  Pool threads come and go, so the ring of a thread that exited is
+   handed to the next new thread of the same name; the number of rings is
+   the most threads that ever traced at the same time.  */
+std::vector<std::unique_ptr<trace_ring>> rings;
+QString trace_path;
+QElapsedTimer trace_clock;
+
+/* Gives the ring of a thread back when the thread exits.  */
+struct ring_owner
+{
+	trace_ring *ring = nullptr;
+
+	~ring_owner ()
+	{
+		if (ring == nullptr)
+			return;
+		QMutexLocker lock (&rings_mutex);
+		ring->in_use = false;
+	}
+};
+
+trace_ring *this_ring ()
+{
+	thread_local ring_owner owner;
+	if (owner.ring != nullptr)
+		return owner.ring;
+
+	QMutexLocker lock (&rings_mutex);
+	QThread *t = QThread::currentThread ();
+	auto app = QCoreApplication::instance ();
+	bool gui = app != nullptr && t == app->thread ();
+	QString key = gui ? QString ("GUI") : t->objectName ();
+	for (auto &r: rings)
+		if (!r->in_use && r->key == key) {
+			r->in_use = true;
+			owner.ring = r.get ();
+			return owner.ring;
+		}
+
+	auto r = std::make_unique<trace_ring> ();
+	r->tid = rings.size () + 1;
+	r->key = key;
+	if (!key.isEmpty ())
+		r->thread_name = key;
+	else
+		r->thread_name = QString ("thread %1").arg (r->tid);
+	owner.ring = r.get ();
+	rings.push_back (std::move (r));
+	return owner.ring;
+}
+
+void add_event (const trace_event &ev)
+{
+	trace_ring *ring = this_ring ();
+	uint64_t n = ring->count.load (std::memory_order_relaxed);
+	ring->events[n % ring_size] = ev;
+	ring->count.store (n + 1, std::memory_order_release);
+}
+
+}
+
+void trace_start (const QString &path)
+{
+	trace_path = path;
+	trace_clock.start ();
+	trace_enabled = true;
+}
+
+uint64_t trace_now ()
+{
+	return trace_clock.nsecsElapsed () / 1000;
+}
+
+void trace_record (const char *name, uint64_t start, uint64_t end, int arg)
+{
+	if (!trace_enabled.load (std::memory_order_relaxed))
+		return;
+	add_event ({ name, start, end - start, arg, false });
+}
+
+void trace_instant (const char *name, int arg)
+{
+	if (!trace_enabled.load (std::memory_order_relaxed))
+		return;
+	add_event ({ name, trace_now (), 0, arg, true });
+}
+
+void trace_write ()
+{
+	if (!trace_enabled)
+		return;
+	trace_enabled = false;
+
+	QJsonArray events;
+	QMutexLocker lock (&rings_mutex);
+	for (auto &r: rings) {
+		QJsonObject meta;
+		meta["name"] = "thread_name";
+		meta["ph"] = "M";
+		meta["pid"] = 1;
+		meta["tid"] = r->tid;
+		meta["args"] = QJsonObject { { "name", r->thread_name } };
+		events.append (meta);
+
+		uint64_t n = r->count.load (std::memory_order_acquire);
+		uint64_t first = n > ring_size ? n - ring_size : 0;
+		for (uint64_t i = first; i < n; i++) {
+			const trace_event &ev = r->events[i % ring_size];
+			QJsonObject o;
+			o["name"] = ev.name;
+			o["ph"] = ev.instant ? "i" : "X";
+			o["ts"] = (qint64)ev.start;
+			if (ev.instant)
+				o["s"] = "t";
+			else
+				o["dur"] = (qint64)ev.dur;
+			o["pid"] = 1;
+			o["tid"] = r->tid;
+			if (ev.arg >= 0)
+				o["args"] = QJsonObject { { "idx", ev.arg } };
+			events.append (o);
+		}
+	}
+	QJsonObject doc;
+	doc["traceEvents"] = events;
+	doc["displayTimeUnit"] = "ms";
+
+	QFile f (trace_path);
+	QByteArray json = QJsonDocument (doc).toJson (QJsonDocument::Compact);
+	if (!f.open (QIODevice::WriteOnly) || f.write (json) != json.size ())
+		fprintf (stderr, "error: cannot write trace to %s\n", trace_path.toLocal8Bit ().constData ());
+}